@@ -0,0 +1,302 @@
+#include "epd_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "e-ink.h"
+#include "epd_hal.h"
+
+/* Commands understood by the model */
+#define DEEP_SLEEP_MODE                             0x10
+#define DATA_ENTRY_MODE_SETTING                     0x11
+#define SW_RESET                                    0x12
+#define MASTER_ACTIVATION                           0x20
+#define WRITE_RAM                                   0x24
+#define WRITE_LUT_REGISTER                          0x32
+#define SET_RAM_X_ADDRESS_START_END_POSITION        0x44
+#define SET_RAM_Y_ADDRESS_START_END_POSITION        0x45
+#define SET_RAM_X_ADDRESS_COUNTER                   0x4E
+#define SET_RAM_Y_ADDRESS_COUNTER                   0x4F
+
+#define ROW_BYTES (EPD_WIDTH / 8)
+#define LUT_SIZE 30
+
+/* Each unit of LUT phase length lasts about this long */
+#define LUT_PHASE_UNIT_US 25000
+
+/* Fixed cost of an SPI transaction: setup, CS and D/C */
+#define TRANS_OVERHEAD_US 8
+
+/* How the ESP32 backend splits transfers, so that the transaction
+ * counts match. */
+#define STAGE_SIZE 128
+#define PATTERN_SIZE 256
+
+/* A panel, which is also its HAL handle */
+struct epd_hal {
+  uint8_t ram[2][EPD_FRAME_SIZE];
+  uint8_t shown[EPD_FRAME_SIZE];
+  int bank;                   /* The bank RAM writes go to */
+  uint8_t lut[LUT_SIZE];
+  uint8_t entry_mode;
+  int x_start, x_end, y_start, y_end;
+  int x, y;
+  uint8_t cmd;                /* Command the data bytes belong to */
+  int argn;                   /* Data bytes since the command */
+  int sleeping;
+  int64_t busy_until_us;
+  epd_sim_stats_t stats;
+};
+
+static struct epd_hal g_panels[EPD_HAL_MAX_PANELS];
+
+/* The SPI bus the panels share, and the simulated time */
+static struct {
+  int spi_clock_hz;
+  int64_t now_us;
+} g_bus;
+
+/* Sum of the phase lengths in the timing part of the LUT. */
+static int64_t lut_duration_us(struct epd_hal* p) {
+  int units = 0;
+  for (int i = 20; i < LUT_SIZE; ++i)
+    units += (p->lut[i] >> 4) + (p->lut[i] & 0x0F);
+  return (int64_t)units * LUT_PHASE_UNIT_US;
+}
+
+static int busy(struct epd_hal* p) {
+  return g_bus.now_us < p->busy_until_us;
+}
+
+/* Move the address counter after a RAM write, as set by the data
+ * entry mode: bit 0 X increments, bit 1 Y increments, bit 2 Y is
+ * the fast axis. */
+static void advance(struct epd_hal* p) {
+  int xinc = p->entry_mode & 1 ? 1 : -1;
+  int yinc = p->entry_mode & 2 ? 1 : -1;
+  int* fast = p->entry_mode & 4 ? &p->y : &p->x;
+  int* slow = p->entry_mode & 4 ? &p->x : &p->y;
+  int finc = p->entry_mode & 4 ? yinc : xinc;
+  int sinc = p->entry_mode & 4 ? xinc : yinc;
+  int f0 = p->entry_mode & 4 ? p->y_start : p->x_start;
+  int f1 = p->entry_mode & 4 ? p->y_end : p->x_end;
+  int s0 = p->entry_mode & 4 ? p->x_start : p->y_start;
+  int s1 = p->entry_mode & 4 ? p->x_end : p->y_end;
+
+  if (*fast != (finc > 0 ? f1 : f0)) {
+    *fast += finc;
+    return;
+  }
+  *fast = finc > 0 ? f0 : f1;
+  if (*slow != (sinc > 0 ? s1 : s0))
+    *slow += sinc;
+  else
+    *slow = sinc > 0 ? s0 : s1;
+}
+
+static void command(struct epd_hal* p, uint8_t cmd) {
+  if (busy(p)) {
+    ++p->stats.ignored_commands;
+    p->cmd = 0;
+    return;
+  }
+  p->cmd = cmd;
+  p->argn = 0;
+  p->sleeping = cmd == DEEP_SLEEP_MODE;
+
+  switch (cmd) {
+  case MASTER_ACTIVATION:
+    /* Show the bank we wrote to, and swap */
+    memcpy(p->shown, p->ram[p->bank], EPD_FRAME_SIZE);
+    p->bank ^= 1;
+    p->busy_until_us = g_bus.now_us + lut_duration_us(p);
+    ++p->stats.updates;
+    p->stats.update_us += lut_duration_us(p);
+    break;
+  case SW_RESET:
+    p->busy_until_us = g_bus.now_us + 10000;
+    break;
+  default:
+    break;
+  }
+}
+
+static void data(struct epd_hal* p, uint8_t b) {
+  int n = p->argn++;
+
+  switch (p->cmd) {
+  case WRITE_RAM:
+    if (p->x >= 0 && p->x < ROW_BYTES
+        && p->y >= 0 && p->y < EPD_HEIGHT)
+      p->ram[p->bank][p->y * ROW_BYTES + p->x] = b;
+    ++p->stats.ram_bytes;
+    advance(p);
+    break;
+  case WRITE_LUT_REGISTER:
+    if (n < LUT_SIZE)
+      p->lut[n] = b;
+    break;
+  case DATA_ENTRY_MODE_SETTING:
+    if (n == 0)
+      p->entry_mode = b & 7;
+    break;
+  case SET_RAM_X_ADDRESS_START_END_POSITION:
+    if (n == 0) p->x_start = b;
+    if (n == 1) p->x_end = b;
+    break;
+  case SET_RAM_Y_ADDRESS_START_END_POSITION:
+    if (n == 0) p->y_start = b;
+    if (n == 1) p->y_start |= b << 8;
+    if (n == 2) p->y_end = b;
+    if (n == 3) p->y_end |= b << 8;
+    break;
+  case SET_RAM_X_ADDRESS_COUNTER:
+    if (n == 0) p->x = b;
+    break;
+  case SET_RAM_Y_ADDRESS_COUNTER:
+    if (n == 0) p->y = b;
+    if (n == 1) p->y |= b << 8;
+    break;
+  default:
+    break;
+  }
+}
+
+static void transfer(struct epd_hal* p, const uint8_t* buf, int len,
+                     int dc) {
+  g_bus.now_us += TRANS_OVERHEAD_US
+    + (int64_t)len * 8 * 1000000 / g_bus.spi_clock_hz;
+  for (int i = 0; i < len; ++i) {
+    if (dc)
+      data(p, buf[i]);
+    else
+      command(p, buf[i]);
+  }
+}
+
+void epd_sim_reset(int spi_clock_hz) {
+  memset(&g_bus, 0, sizeof(g_bus));
+  for (int i = 0; i < EPD_HAL_MAX_PANELS; ++i) {
+    struct epd_hal* p = &g_panels[i];
+
+    memset(p, 0, sizeof(*p));
+    memset(p->ram, 0xFF, sizeof(p->ram));
+    memset(p->shown, 0xFF, sizeof(p->shown));
+    p->entry_mode = 0x03;
+    p->x_end = ROW_BYTES - 1;
+    p->y_end = EPD_HEIGHT - 1;
+  }
+  g_bus.spi_clock_hz = spi_clock_hz;
+}
+
+const uint8_t* epd_sim_shown(int panel) {
+  return g_panels[panel].shown;
+}
+
+int epd_sim_save_pbm(int panel, const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL)
+    return -1;
+  /* In a PBM, 1 is black */
+  fprintf(f, "P4\n%d %d\n", EPD_WIDTH, EPD_HEIGHT);
+  for (int i = 0; i < EPD_FRAME_SIZE; ++i)
+    fputc(~g_panels[panel].shown[i] & 0xFF, f);
+  return fclose(f);
+}
+
+void epd_sim_get_stats(int panel, epd_sim_stats_t* stats) {
+  *stats = g_panels[panel].stats;
+}
+
+int64_t epd_sim_time_us(void) {
+  return g_bus.now_us;
+}
+
+/* The e-ink HAL, on the model */
+
+epd_hal_t* epd_hal_init(epd_hal_spi_t spi, int dc_pin, int busy_pin) {
+  intptr_t panel = (intptr_t)spi;
+
+  (void)dc_pin;
+  (void)busy_pin;
+  if (panel < 0 || panel >= EPD_HAL_MAX_PANELS)
+    return NULL;
+  return &g_panels[panel];
+}
+
+int epd_hal_write(epd_hal_t* hal, const uint8_t* data, int len, int dc) {
+  if (len == 0)
+    return 0;
+  transfer(hal, data, len, dc);
+  return 1;
+}
+
+int epd_hal_write_rows(epd_hal_t* hal, const uint8_t* src, int stride,
+                       int row_bytes, int rows) {
+  int count = 0;
+
+  if (row_bytes == stride)
+    return epd_hal_write(hal, src, row_bytes * rows, 1);
+
+  while (rows > 0) {
+    uint8_t stage[STAGE_SIZE];
+    int n = STAGE_SIZE / row_bytes;
+    if (n > rows)
+      n = rows;
+    for (int j = 0; j < n; ++j) {
+      memcpy(&stage[j * row_bytes], src, row_bytes);
+      src += stride;
+    }
+    transfer(hal, stage, n * row_bytes, 1);
+    rows -= n;
+    ++count;
+  }
+  return count;
+}
+
+int epd_hal_write_fill(epd_hal_t* hal, uint8_t value, int len) {
+  uint8_t pattern[PATTERN_SIZE];
+  int count = 0;
+
+  memset(pattern, value, sizeof(pattern));
+  while (len > 0) {
+    int n = len < PATTERN_SIZE ? len : PATTERN_SIZE;
+    transfer(hal, pattern, n, 1);
+    len -= n;
+    ++count;
+  }
+  return count;
+}
+
+void epd_hal_flush(epd_hal_t* hal) {
+  /* Transfers complete as they are made */
+  (void)hal;
+}
+
+void epd_hal_sync(epd_hal_t* hal, int pending) {
+  (void)hal;
+  (void)pending;
+}
+
+int epd_hal_busy(epd_hal_t* hal) {
+  return busy(hal);
+}
+
+esp_err_t epd_hal_wait_busy(epd_hal_t* hal, int timeout_ms) {
+  if (!busy(hal))
+    return ESP_OK;
+  if (hal->busy_until_us - g_bus.now_us > (int64_t)timeout_ms * 1000) {
+    g_bus.now_us += (int64_t)timeout_ms * 1000;
+    return ESP_ERR_TIMEOUT;
+  }
+  g_bus.now_us = hal->busy_until_us;
+  return ESP_OK;
+}
+
+void epd_hal_delay_ms(int ms) {
+  g_bus.now_us += (int64_t)ms * 1000;
+}
+
+int64_t epd_hal_time_us(void) {
+  return g_bus.now_us;
+}
@@ -0,0 +1,47 @@
+#ifndef __EPD_SIM_H__
+#define __EPD_SIM_H__
+
+/* Simulated SSD16xx e-ink controller, implementing the e-ink HAL for
+ * the host build.
+ *
+ * The model follows the command stream the way the controller does:
+ * RAM X/Y windows and address counters, the data entry mode, and two
+ * RAM banks that swap on every display update. BUSY is asserted for
+ * a duration modeled from the phase lengths of the loaded LUT. Time
+ * is simulated: SPI transfers advance the clock by their modeled
+ * duration at the configured SPI clock, and waiting for BUSY advances
+ * it to the end of the update, so no real time passes.
+ *
+ * Up to EPD_HAL_MAX_PANELS panels share the one bus and clock, so one
+ * can be sent to while another is busy. Pass EPD_SIM_PANEL(n) to
+ * epd_init as the SPI device of panel n.
+ */
+
+#include <stdint.h>
+
+#include "epd_hal.h"
+
+#define EPD_SIM_PANEL(n) ((epd_hal_spi_t)(intptr_t)(n))
+
+typedef struct {
+  uint32_t updates;          /* Display updates (MASTER_ACTIVATION) */
+  uint32_t ignored_commands; /* Commands sent while BUSY */
+  uint32_t ram_bytes;        /* Bytes written to RAM */
+  int64_t update_us;         /* Modeled time of all updates */
+} epd_sim_stats_t;
+
+/* Power up the panels: RAM cleared to white, registers reset. */
+void epd_sim_reset(int spi_clock_hz);
+
+/* The image currently on a panel, one bit per pixel, 1 is white. */
+const uint8_t* epd_sim_shown(int panel);
+
+/* Write the image on a panel as a binary PBM. */
+int epd_sim_save_pbm(int panel, const char* path);
+
+void epd_sim_get_stats(int panel, epd_sim_stats_t* stats);
+
+/* The simulated time, in microseconds since the reset. */
+int64_t epd_sim_time_us(void);
+
+#endif
@@ -0,0 +1,10 @@
+/* Host build of the rendering benchmarks. See main/bench.h.
+ *
+ *   forecast_bench > bench.json
+ */
+#include "bench.h"
+
+int main(void) {
+  bench_run();
+  return 0;
+}
@@ -0,0 +1,43 @@
+/* libFuzzer entry point of the forecast parser.
+ *
+ *   make -C host fuzz
+ *   cp -r host/corpus/json /tmp/corpus
+ *   host/build/forecast_fuzz /tmp/corpus
+ *
+ * The first two bytes of an input pick a chunk size and where to cut
+ * the response short, the rest is the response. Besides what the
+ * sanitizers catch, it aborts if the chunked response parses
+ * differently from the whole one, or the response cut short gives a
+ * day or hour that the whole one doesn't. forecast_fuzz_wire does the
+ * same for the binary record.
+ */
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "parse_run.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t len) {
+  parse_run_t whole, run;
+  size_t chunk, cut;
+
+  if (len < 2)
+    return 0;
+  chunk = data[0] + 1;
+  cut = (len - 2) * data[1] / 256;
+  data += 2;
+  len -= 2;
+  host_log_enabled = 0;
+
+  parse_run(data, len, 0, &whole);
+  parse_run(data, len, chunk, &run);
+  if (!parse_run_same(&run, &whole))
+    abort();
+
+  parse_run(data, cut, chunk, &run);
+  if (run.result == PARSE_ERROR && whole.result != PARSE_ERROR)
+    abort();
+  if (whole.result == PARSE_FORECAST && !parse_run_within(&run, &whole))
+    abort();
+  return 0;
+}
@@ -0,0 +1,275 @@
+/* Host harness of the forecast parser, over recorded responses.
+ *
+ *   forecast_parse [-u] FILE...
+ *
+ * Each FILE is a whole HTTP response as it came off the socket, see
+ * host/corpus. It is checked that:
+ *
+ *   - feeding it in chunks of 1, 7, 64, 536 and 1460 bytes gives the
+ *     same result, forecast and version as all at once;
+ *   - cut short anywhere, it isn't rejected unless the whole one is,
+ *     and gives no day or hour that differs from the whole forecast;
+ *   - the result, days, hours, days with sun times, fingerprint and
+ *     cache fingerprint (of the values themselves) match the .expect
+ *     file next to it, if there is one. With -u, that is written
+ *     instead.
+ *
+ * Then the throughput, in 1460 byte chunks and a byte at a time, and
+ * the heap allocations and peak heap use during one parse are printed
+ * as one JSON object per line:
+ *
+ *   {"name":"apixu_2days","parser":"json","bytes":32573,
+ *    "consumed":32573,"result":"forecast","days":2,"hours":48,
+ *    "sun_days":2,"hash":"1f0e8c2a","cache":"8d41f0b7","mb_per_s":61.2,
+ *    "mb_per_s_byte":40.5,"allocs":0,"peak_heap":0,"state_bytes":184,
+ *    "ok":true}
+ *
+ * The exit status is 1 if any check failed. The heap is counted by
+ * wrapping the glibc allocator, so this only builds against glibc.
+ */
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+
+#include "parse_run.h"
+
+#if CONFIG_FORECAST_BINARY
+#define PARSER_NAME "wire"
+#else
+#define PARSER_NAME "json"
+#endif
+
+/* Cut every response short at each of its first PREFIX_ALL bytes, and
+ * at PREFIX_STEPS points spread over the rest */
+#define PREFIX_ALL 512
+#define PREFIX_STEPS 512
+
+#define SEGMENT 1460
+#define MIN_TIME_NS (200*1000*1000LL)
+
+static const size_t g_chunks[] = { 1, 7, 64, 536, SEGMENT };
+
+/* Heap use, while g_counting */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static int g_counting;
+static size_t g_allocs;
+static size_t g_heap;
+static size_t g_peak;
+
+static void heap_add(void* ptr) {
+  if (!g_counting || ptr == NULL)
+    return;
+  ++g_allocs;
+  g_heap += malloc_usable_size(ptr);
+  if (g_heap > g_peak)
+    g_peak = g_heap;
+}
+
+static void heap_remove(void* ptr) {
+  size_t size;
+
+  if (!g_counting || ptr == NULL)
+    return;
+  size = malloc_usable_size(ptr);
+  g_heap = g_heap > size ? g_heap - size : 0;
+}
+
+void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+
+  heap_add(ptr);
+  return ptr;
+}
+
+void* calloc(size_t n, size_t size) {
+  void* ptr = __libc_calloc(n, size);
+
+  heap_add(ptr);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  heap_remove(ptr);
+  ptr = __libc_realloc(ptr, size);
+  heap_add(ptr);
+  return ptr;
+}
+
+void free(void* ptr) {
+  heap_remove(ptr);
+  __libc_free(ptr);
+}
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+  FILE* f = fopen(path, "rb");
+  uint8_t* data = NULL;
+  long size;
+
+  if (f == NULL)
+    return NULL;
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0
+      && fseek(f, 0, SEEK_SET) == 0) {
+    data = malloc(size ? size : 1);
+    if (data != NULL && fread(data, 1, size, f) != (size_t)size) {
+      free(data);
+      data = NULL;
+    }
+    *len = size;
+  }
+  fclose(f);
+  return data;
+}
+
+static int fail(const char* name, const char* what, size_t at) {
+  fprintf(stderr, "%s: %s at %zu\n", name, what, at);
+  return 0;
+}
+
+/* The checks of the comment at the top, all but the expected result */
+static int check(const char* name, const uint8_t* data, size_t len,
+                 const parse_run_t* whole) {
+  parse_run_t run;
+  size_t step;
+
+  for (size_t i = 0; i < sizeof(g_chunks) / sizeof(g_chunks[0]); ++i) {
+    parse_run(data, len, g_chunks[i], &run);
+    if (!parse_run_same(&run, whole))
+      return fail(name, "different result in chunks of", g_chunks[i]);
+  }
+
+  step = len > PREFIX_ALL ? (len - PREFIX_ALL) / PREFIX_STEPS + 1 : 1;
+  for (size_t cut = 0; cut < len; cut += cut < PREFIX_ALL ? 1 : step) {
+    parse_run(data, cut, SEGMENT, &run);
+    if (run.result == PARSE_ERROR && whole->result != PARSE_ERROR)
+      return fail(name, "rejected when cut short", cut);
+    if (whole->result == PARSE_FORECAST && !parse_run_within(&run, whole))
+      return fail(name, "different forecast when cut short", cut);
+  }
+  return 1;
+}
+
+/* Compare with or write the expected result next to path */
+static int expect(const char* path, const char* name, int name_len,
+                  const parse_run_t* run, int update) {
+  char expect_path[512];
+  char line[128], want[128];
+  FILE* f;
+
+  snprintf(line, sizeof(line), "%s %d %d %d %08x %08x\n",
+           parse_result_name(run->result), parse_run_days(run),
+           parse_run_hours(run), parse_run_sun_days(run), run->version.hash,
+           parse_run_cache_hash(run));
+  snprintf(expect_path, sizeof(expect_path), "%.*s.expect",
+           (int)(strlen(path) - strlen(name) + name_len), path);
+  if (update) {
+    f = fopen(expect_path, "w");
+    if (f == NULL || fputs(line, f) < 0) {
+      fprintf(stderr, "%s: can't write %s\n", name, expect_path);
+      return 0;
+    }
+    fclose(f);
+    return 1;
+  }
+
+  f = fopen(expect_path, "r");
+  if (f == NULL)
+    return 1;
+  if (fgets(want, sizeof(want), f) == NULL)
+    want[0] = '\0';
+  fclose(f);
+  if (strcmp(line, want) != 0) {
+    fprintf(stderr, "%s: got %sexpected %s", name, line, want);
+    return 0;
+  }
+  return 1;
+}
+
+/* MB/s parsing data in chunks of chunk bytes */
+static double throughput(const uint8_t* data, size_t len, size_t chunk) {
+  parse_run_t run;
+  long long start = now_ns(), elapsed;
+  size_t bytes = 0;
+
+  do {
+    parse_run(data, len, chunk, &run);
+    bytes += run.consumed;
+    elapsed = now_ns() - start;
+  } while (elapsed < MIN_TIME_NS);
+  return bytes * 1000.0 / elapsed;
+}
+
+static int run_file(const char* path, int update) {
+  const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  int name_len = strcspn(name, ".");
+  parse_run_t whole, run;
+  uint8_t* data;
+  size_t len;
+  int ok;
+
+  data = read_file(path, &len);
+  if (data == NULL) {
+    fprintf(stderr, "%s: can't read\n", path);
+    return 0;
+  }
+
+  parse_run(data, len, 0, &whole);
+  ok = check(name, data, len, &whole);
+  ok = expect(path, name, name_len, &whole, update) && ok;
+
+  g_allocs = g_heap = g_peak = 0;
+  g_counting = 1;
+  parse_run(data, len, SEGMENT, &run);
+  g_counting = 0;
+
+  printf("{\"name\":\"%.*s\",\"parser\":\"%s\",\"bytes\":%zu,"
+         "\"consumed\":%zu,\"result\":\"%s\",\"days\":%d,\"hours\":%d,"
+         "\"sun_days\":%d,\"hash\":\"%08x\",\"cache\":\"%08x\"",
+         name_len, name, PARSER_NAME, len, whole.consumed,
+         parse_result_name(whole.result), parse_run_days(&whole),
+         parse_run_hours(&whole), parse_run_sun_days(&whole),
+         whole.version.hash, parse_run_cache_hash(&whole));
+  printf(",\"mb_per_s\":%.1f,\"mb_per_s_byte\":%.1f",
+         throughput(data, len, SEGMENT), throughput(data, len, 1));
+  printf(",\"allocs\":%zu,\"peak_heap\":%zu,\"state_bytes\":%zu,"
+         "\"ok\":%s}\n",
+         g_allocs, g_peak, sizeof(forecast_parser_t), ok ? "true" : "false");
+  fflush(stdout);
+
+  free(data);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  int update = 0;
+  int ok = 1;
+  int i = 1;
+
+  if (argc > 1 && strcmp(argv[1], "-u") == 0) {
+    update = 1;
+    ++i;
+  }
+  if (i == argc) {
+    fprintf(stderr, "usage: forecast_parse [-u] FILE...\n");
+    return 2;
+  }
+
+  host_log_enabled = 0;
+  for (; i < argc; ++i)
+    ok = run_file(argv[i], update) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/* Host simulation of the forecast display.
+ *
+ * Renders a sequence of forecasts through the real rendering, refresh
+ * and e-ink driver code, on the simulated panel. Each forecast is one
+ * wake from deep sleep, the first one a cold boot, so the RTC state,
+ * partial refreshes and glyph cycling behave as on the device. The
+ * panel is written out as a PBM after every wake, along with the
+ * modeled SPI and refresh times.
+ *
+ * With -n 2, each wake takes a forecast per panel and shows both at
+ * once, as epd_refresh_show_all does. Only the first panel's frame is
+ * kept in RTC memory, so the second one has a full update every wake.
+ *
+ * With -s, each wake only starts the update and deep sleeps through
+ * it, as with CONFIG_EPD_SLEEP_DURING_UPDATE, and a short wake then
+ * finishes with the display.
+ *
+ *   forecast_sim [-o prefix] [-n PANELS | -s] CODE MIN MAX [CODE MIN MAX ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_sleep.h"
+
+#include "e-ink.h"
+#include "epd_refresh.h"
+#include "epd_sim.h"
+#include "forecast.h"
+#include "forecast_graphics.h"
+#include "rtc_state.h"
+#include "text.h"
+
+#define EPD_CLOCK_HZ (10*1000*1000)
+
+static void usage(void) {
+  fprintf(stderr, "usage: forecast_sim [-o prefix] [-n PANELS | -s] "
+          "CODE MIN MAX [CODE MIN MAX ...]\n");
+  exit(2);
+}
+
+/* The panels. Only the first one's shown frame is in RTC memory, the
+ * others are always fully refreshed. */
+static epd_panel_t g_panels[EPD_HAL_MAX_PANELS];
+
+/* The short wake after sleeping through an update, as epd_update_done
+ * in main.c does it */
+static rtc_state_t* update_done(int wake) {
+  rtc_state_t* state;
+
+  rtc_state_save();
+  host_wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+  state = rtc_state_load();
+  memset(&g_panels[0], 0, sizeof(g_panels[0]));
+  g_panels[0].shown = &state->epd;
+  epd_attach(&g_panels[0].epd, EPD_SIM_PANEL(0), 0, 0);
+  if (epd_wait_busy(&g_panels[0].epd) != ESP_OK)
+    fprintf(stderr, "wake %d: display stuck busy\n", wake);
+  epd_refresh_finish(&g_panels[0]);
+  epd_sleep(&g_panels[0].epd);
+  return state;
+}
+
+int main(int argc, char** argv) {
+  epd_panel_t* panels[EPD_HAL_MAX_PANELS];
+  const char* prefix = "wake";
+  int sleep_update = 0;
+  int n = 1;
+  int i = 1;
+
+  while (argc - i > 1) {
+    if (strcmp(argv[i], "-s") == 0) {
+      sleep_update = 1;
+      i += 1;
+    } else if (strcmp(argv[i], "-o") == 0) {
+      prefix = argv[i+1];
+      i += 2;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      n = atoi(argv[i+1]);
+      i += 2;
+    } else {
+      break;
+    }
+  }
+  if (n < 1 || n > EPD_HAL_MAX_PANELS || (sleep_update && n != 1)
+      || argc - i < 3 * n || (argc - i) % (3 * n) != 0)
+    usage();
+
+  epd_sim_reset(EPD_CLOCK_HZ);
+  host_wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+  for (int wake = 0; i < argc; i += 3 * n, ++wake) {
+    forecast_t forecasts[EPD_HAL_MAX_PANELS];
+    rtc_state_t* state = rtc_state_load();
+    epd_sim_stats_t before[EPD_HAL_MAX_PANELS], after;
+    int64_t start = epd_sim_time_us();
+    char path[256];
+
+    /* Nothing but the RTC state survives deep sleep */
+    memset(g_panels, 0, sizeof(g_panels));
+    for (int p = 0; p < n; ++p) {
+      forecast_t forecast = {
+        .day = 1,
+        .code = atoi(argv[i+3*p]),
+        .temp_min = atoi(argv[i+3*p+1]),
+        .temp_max = atoi(argv[i+3*p+2]),
+      };
+      forecasts[p] = forecast;
+      panels[p] = &g_panels[p];
+      g_panels[p].shown = p == 0 ? &state->epd : NULL;
+      epd_sim_get_stats(p, &before[p]);
+    }
+    text_set_glyph_state(state->glyph_indexes);
+
+    if (n == 1 && state->forecast_valid
+        && memcmp(&state->forecast, &forecasts[0], sizeof(forecasts[0])) == 0) {
+      printf("wake %d: forecast unchanged\n", wake);
+    } else {
+      for (int p = 0; p < n; ++p) {
+        if (epd_init(&g_panels[p].epd, EPD_SIM_PANEL(p), lut_full_update,
+                     0, 0) != ESP_OK) {
+          fprintf(stderr, "wake %d: no panel %d\n", wake, p);
+          return 1;
+        }
+      }
+      if (sleep_update) {
+        if (start_forecast(&g_panels[0], &forecasts[0]) != ESP_OK) {
+          fprintf(stderr, "wake %d: draw failed\n", wake);
+          return 1;
+        }
+      } else if (draw_forecasts(panels, forecasts, n) != ESP_OK) {
+        fprintf(stderr, "wake %d: draw failed\n", wake);
+        return 1;
+      }
+      state->forecast = forecasts[0];
+      state->forecast_valid = 1;
+      text_get_glyph_state(state->glyph_indexes);
+
+      if (state->epd.bank_stale) {
+        printf("wake %d: awake %lld us, sleeping through the update\n",
+               wake, (long long)(epd_sim_time_us() - start));
+        state = update_done(wake);
+      } else {
+        for (int p = 0; p < n; ++p) {
+          if (epd_wait_busy(&g_panels[p].epd) != ESP_OK)
+            fprintf(stderr, "wake %d: display %d stuck busy\n", wake, p);
+          epd_sleep(&g_panels[p].epd);
+        }
+      }
+
+      for (int p = 0; p < n; ++p) {
+        epd_stats_t stats;
+
+        epd_get_stats(&g_panels[p].epd, &stats);
+        epd_sim_get_stats(p, &after);
+        if (n == 1)
+          snprintf(path, sizeof(path), "%s-%d.pbm", prefix, wake);
+        else
+          snprintf(path, sizeof(path), "%s-%d-%d.pbm", prefix, wake, p);
+        if (epd_sim_save_pbm(p, path) != 0) {
+          perror(path);
+          return 1;
+        }
+        printf("wake %d: %s, %u updates, %u RAM bytes, "
+               "%u transactions, spi %lld us, busy %lld us\n",
+               wake, path, after.updates - before[p].updates,
+               after.ram_bytes - before[p].ram_bytes, stats.transactions,
+               (long long)stats.spi_us, (long long)stats.busy_us);
+        if (after.ignored_commands != before[p].ignored_commands)
+          printf("wake %d: %u commands sent while busy\n", wake,
+                 after.ignored_commands - before[p].ignored_commands);
+      }
+      printf("wake %d: %lld us in all\n", wake,
+             (long long)(epd_sim_time_us() - start));
+    }
+
+    rtc_state_save();
+    host_wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+  }
+
+  return 0;
+}
@@ -0,0 +1,26 @@
+/* Host implementations of the few ESP-IDF functions used by the
+ * rendering and display stack.
+ */
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "rom/crc.h"
+
+int host_log_enabled = 1;
+
+esp_sleep_wakeup_cause_t host_wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void) {
+  return host_wakeup_cause;
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; ++i)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
@@ -0,0 +1,27 @@
+/* Host stand-in for the ESP-IDF header of the same name. Logs go to
+ * stderr, unless host_log_enabled is cleared; debug logs only with
+ * -DHOST_LOG_DEBUG.
+ */
+#ifndef __HOST_ESP_LOG_H__
+#define __HOST_ESP_LOG_H__
+
+#include <stdio.h>
+
+extern int host_log_enabled;
+
+#define HOST_LOG(level, tag, format, ...)                               \
+  do {                                                                  \
+    if (host_log_enabled)                                               \
+      fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__);  \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#ifdef HOST_LOG_DEBUG
+#define ESP_LOGD(tag, format, ...) HOST_LOG("D", tag, format, ##__VA_ARGS__)
+#else
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+#endif
+
+#endif
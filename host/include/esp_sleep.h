@@ -0,0 +1,19 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#ifndef __HOST_ESP_SLEEP_H__
+#define __HOST_ESP_SLEEP_H__
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED,
+  ESP_SLEEP_WAKEUP_ALL,
+  ESP_SLEEP_WAKEUP_EXT0,
+  ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER,
+} esp_sleep_wakeup_cause_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+
+/* Host only: what esp_sleep_get_wakeup_cause returns, to simulate
+ * deep sleep wakes. */
+extern esp_sleep_wakeup_cause_t host_wakeup_cause;
+
+#endif
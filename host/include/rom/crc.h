@@ -0,0 +1,9 @@
+/* Host stand-in for the ESP32 ROM CRC functions. */
+#ifndef __HOST_ROM_CRC_H__
+#define __HOST_ROM_CRC_H__
+
+#include <stdint.h>
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif
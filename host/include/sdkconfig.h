@@ -0,0 +1,6 @@
+/* Host build configuration, standing in for the sdkconfig.h generated
+ * by menuconfig. Keep the defaults in step with Kconfig.projbuild.
+ */
+#define CONFIG_EPD_FULL_REFRESH_INTERVAL 10
+#define CONFIG_FORECAST_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+#define CONFIG_FORECAST_UPDATE_INTERVAL 900
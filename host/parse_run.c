@@ -0,0 +1,150 @@
+#include "parse_run.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "forecast_cache.h"
+
+void parse_run(const uint8_t* data, size_t len, size_t chunk,
+               parse_run_t* run) {
+  forecast_parser_t parser;
+  forecast_parser_status_t status = FORECAST_PARSER_MORE;
+  size_t i = 0;
+
+  memset(run, 0, sizeof(*run));
+  if (chunk == 0)
+    chunk = len;
+  forecast_parser_init(&parser, &run->cache, &run->version);
+  while (i < len && status == FORECAST_PARSER_MORE) {
+    size_t n = len - i < chunk ? len - i : chunk;
+
+    status = forecast_parser_feed(&parser, data + i, n);
+    i += n;
+  }
+  run->consumed = i;
+  snprintf(run->date, sizeof(run->date), "%s", parser.date);
+
+  switch (status) {
+  case FORECAST_PARSER_NOT_MODIFIED:
+    run->result = PARSE_NOT_MODIFIED;
+    break;
+  case FORECAST_PARSER_ERROR:
+    run->result = PARSE_ERROR;
+    break;
+  default:
+    /* Finished either way, for the days and hours it has, but a
+     * response that ended before the parser was done is cut short, and
+     * get_forecast fails it */
+    run->result = forecast_parser_finish(&parser) == ESP_OK
+      && status == FORECAST_PARSER_DONE ? PARSE_FORECAST : PARSE_INCOMPLETE;
+    break;
+  }
+}
+
+int parse_run_same(const parse_run_t* a, const parse_run_t* b) {
+  return a->result == b->result
+    && memcmp(&a->cache, &b->cache, sizeof(a->cache)) == 0
+    && a->version.hash == b->version.hash
+    && strcmp(a->version.etag, b->version.etag) == 0
+    && strcmp(a->version.last_modified, b->version.last_modified) == 0
+    && strcmp(a->date, b->date) == 0;
+}
+
+static int same_fields(const parse_run_t* a, const parse_run_t* b,
+                       forecast_field_t first, forecast_field_t last,
+                       int index) {
+  for (forecast_field_t f = first; f <= last; ++f) {
+    if (forecast_cache_get(&a->cache, f, index)
+        != forecast_cache_get(&b->cache, f, index))
+      return 0;
+  }
+  return 1;
+}
+
+/* Whether day d has its sunrise and sunset */
+static int has_sun(const parse_run_t* run, int d) {
+  return forecast_cache_get(&run->cache, FORECAST_DAY_SUNRISE, d)
+    < forecast_cache_get(&run->cache, FORECAST_DAY_SUNSET, d);
+}
+
+int parse_run_within(const parse_run_t* part, const parse_run_t* whole) {
+  if (parse_run_days(part) == 0)
+    return 1;
+  if (part->cache.first_day != whole->cache.first_day)
+    return 0;
+  for (int d = 0; d < FORECAST_CACHE_DAYS; ++d) {
+    if (forecast_cache_get(&part->cache, FORECAST_DAY_VALID, d)
+        && !same_fields(part, whole, FORECAST_DAY_VALID, FORECAST_DAY_MAX, d))
+      return 0;
+    if (has_sun(part, d)
+        && !same_fields(part, whole, FORECAST_DAY_SUNRISE,
+                        FORECAST_DAY_SUNSET, d))
+      return 0;
+  }
+  for (int h = 0; h < FORECAST_CACHE_HOURS; ++h) {
+    if (forecast_cache_get(&part->cache, FORECAST_HOUR_VALID, h)
+        && !same_fields(part, whole, FORECAST_HOUR_VALID,
+                        FORECAST_HOUR_IS_DAY, h))
+      return 0;
+  }
+  return 1;
+}
+
+int parse_run_days(const parse_run_t* run) {
+  int n = 0;
+
+  for (int d = 0; d < FORECAST_CACHE_DAYS; ++d)
+    n += forecast_cache_get(&run->cache, FORECAST_DAY_VALID, d);
+  return n;
+}
+
+int parse_run_sun_days(const parse_run_t* run) {
+  int n = 0;
+
+  for (int d = 0; d < FORECAST_CACHE_DAYS; ++d)
+    n += forecast_cache_get(&run->cache, FORECAST_DAY_VALID, d)
+      && has_sun(run, d);
+  return n;
+}
+
+int parse_run_hours(const parse_run_t* run) {
+  int n = 0;
+
+  for (int h = 0; h < FORECAST_CACHE_HOURS; ++h)
+    n += forecast_cache_get(&run->cache, FORECAST_HOUR_VALID, h);
+  return n;
+}
+
+/* FNV-1a, like the version */
+static uint32_t hash_bytes(uint32_t h, const void* data, size_t len) {
+  const uint8_t* p = data;
+
+  while (len-- > 0)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+uint32_t parse_run_cache_hash(const parse_run_t* run) {
+  uint32_t first_day = run->cache.first_day;
+  uint8_t day[4] = { first_day, first_day >> 8, first_day >> 16,
+                     first_day >> 24 };
+  uint32_t h = 2166136261u;
+
+  h = hash_bytes(h, day, sizeof(day));
+  h = hash_bytes(h, run->cache.days, sizeof(run->cache.days));
+  return hash_bytes(h, run->cache.hours, sizeof(run->cache.hours));
+}
+
+const char* parse_result_name(parse_result_t result) {
+  switch (result) {
+  case PARSE_FORECAST:
+    return "forecast";
+  case PARSE_NOT_MODIFIED:
+    return "not_modified";
+  case PARSE_ERROR:
+    return "error";
+  case PARSE_INCOMPLETE:
+    return "incomplete";
+  }
+  return "?";
+}
@@ -0,0 +1,55 @@
+#ifndef __PARSE_RUN_H__
+#define __PARSE_RUN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "forecast_parser.h"
+
+/* Runs a recorded response through the forecast parser the way
+ * get_forecast does, for the parser harness and the fuzzer.
+ *
+ * The response is fed chunk bytes at a time until the parser is done
+ * with it, then finished as if the connection had closed.
+ */
+
+typedef enum {
+  PARSE_FORECAST,     /* A forecast, at least the first day of it */
+  PARSE_NOT_MODIFIED, /* A 304 */
+  PARSE_ERROR,        /* Rejected while parsing */
+  PARSE_INCOMPLETE,   /* Ended without a usable forecast */
+} parse_result_t;
+
+typedef struct {
+  parse_result_t result;
+  size_t consumed; /* Bytes fed before the parser was done */
+  forecast_cache_t cache;
+  forecast_version_t version;
+  char date[FORECAST_DATE_MAX];
+} parse_run_t;
+
+/* Parse the len bytes at data, chunk bytes at a time (0 for all at
+ * once), into run. */
+void parse_run(const uint8_t* data, size_t len, size_t chunk,
+               parse_run_t* run);
+
+/* Whether two runs give the same result, forecast and version. */
+int parse_run_same(const parse_run_t* a, const parse_run_t* b);
+
+/* Whether every day and hour that part has is the same in whole, i.e.
+ * a response cut short gave nothing that the whole one doesn't. */
+int parse_run_within(const parse_run_t* part, const parse_run_t* whole);
+
+/* The number of days and hours in the cache of run, and of days with
+ * their sunrise and sunset. */
+int parse_run_days(const parse_run_t* run);
+int parse_run_hours(const parse_run_t* run);
+int parse_run_sun_days(const parse_run_t* run);
+
+/* A fingerprint of what the cache of run holds, days and hours, to
+ * tell the values apart and not only their count. */
+uint32_t parse_run_cache_hash(const parse_run_t* run);
+
+const char* parse_result_name(parse_result_t result);
+
+#endif
@@ -0,0 +1,116 @@
+#include "assets.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* The generated tables */
+#include "assets_gen.inc"
+
+enum {
+  OP_LITERAL,
+  OP_RUN,
+  OP_COPY,
+};
+
+void assets_icon_open(assets_reader_t* r, int icon) {
+  const assets_blob_t* blob = &assets_icons[icon];
+
+  memset(r, 0, offsetof(assets_reader_t, window));
+  r->src = assets_icon_data + blob->offset;
+  r->end = r->src + blob->size;
+  r->codec = blob->codec;
+}
+
+/* Start the next token. Returns 0 at the end of the data. */
+static int next_token(assets_reader_t* r) {
+  uint8_t c;
+
+  if (r->codec == ASSETS_CODEC_RAW) {
+    int n = r->end - r->src;
+    r->op = OP_LITERAL;
+    r->count = n > 0xFF ? 0xFF : n;
+    return r->count != 0;
+  }
+
+  if (r->src == r->end)
+    return 0;
+  c = *r->src++;
+  if (c < 0x80) {
+    r->op = OP_LITERAL;
+    r->count = c + 1;
+    return 1;
+  }
+  if (r->src == r->end)
+    return 0;
+  r->op = r->codec == ASSETS_CODEC_RLE ? OP_RUN : OP_COPY;
+  r->count = (c & 0x7F) + (r->op == OP_RUN ? 2 : 3);
+  r->arg = *r->src++;
+  return 1;
+}
+
+/* Copy a match. Output from this read is taken from the buffer, and
+ * only older output from the window. */
+static void lz_copy(assets_reader_t* r, uint8_t* buf, int pos, int n) {
+  int dist = r->arg + 1;
+  int i = 0;
+
+  for (; i < n && pos + i < dist; ++i)
+    buf[pos + i] = r->window[(uint8_t)(r->wpos + pos + i - dist)];
+  if (dist == 1 && i < n) {
+    memset(buf + pos + i, buf[pos + i - 1], n - i);
+    return;
+  }
+  /* The match may overlap itself, so copy at most dist at a time */
+  while (i < n) {
+    int chunk = n - i < dist ? n - i : dist;
+    memcpy(buf + pos + i, buf + pos + i - dist, chunk);
+    i += chunk;
+  }
+}
+
+/* Keep the last of the output in the window, for later reads. */
+static void lz_update_window(assets_reader_t* r, const uint8_t* buf,
+                             int len) {
+  int n = len < ASSETS_LZ_WINDOW ? len : ASSETS_LZ_WINDOW;
+  int pos = (uint8_t)(r->wpos + len - n);
+  int first = ASSETS_LZ_WINDOW - pos < n ? ASSETS_LZ_WINDOW - pos : n;
+
+  memcpy(r->window + pos, buf + len - n, first);
+  memcpy(r->window, buf + len - n + first, n - first);
+  r->wpos += len;
+}
+
+int assets_read(assets_reader_t* r, uint8_t* buf, int len) {
+  int done = 0;
+
+  while (done < len) {
+    int n;
+
+    if (r->count == 0 && !next_token(r))
+      break;
+    n = len - done < r->count ? len - done : r->count;
+
+    switch (r->op) {
+    case OP_LITERAL:
+      if (n > r->end - r->src)
+        n = r->end - r->src;
+      memcpy(buf + done, r->src, n);
+      r->src += n;
+      break;
+    case OP_RUN:
+      memset(buf + done, r->arg, n);
+      break;
+    case OP_COPY:
+      lz_copy(r, buf, done, n);
+      break;
+    }
+    if (n == 0)
+      break;
+    r->count -= n;
+    done += n;
+  }
+
+  if (r->codec == ASSETS_CODEC_LZ)
+    lz_update_window(r, buf, done);
+  return done;
+}
@@ -0,0 +1,75 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <stdint.h>
+
+#include "assets_gen.h"
+
+/* Icons and glyphs, generated at build time from main/images by
+ * tools/gen_assets.py.
+ *
+ * Each icon is compressed with whichever codec makes it smallest:
+ *
+ *   RAW  the frame as is.
+ *   RLE  a control byte c: if c < 0x80, c+1 literal bytes follow,
+ *        otherwise the next byte is repeated (c & 0x7F)+2 times.
+ *   LZ   a control byte c: if c < 0x80, c+1 literal bytes follow,
+ *        otherwise (c & 0x7F)+3 bytes are copied from d+1 bytes back,
+ *        where d is the next byte.
+ *
+ * Icons are decoded front to back with a reader, in pieces of any
+ * size, so that a whole frame never has to be held at once.
+ *
+ * The glyphs are cropped to the bounding box of their non-blank
+ * pixels, in byte columns. Each row of a glyph in the atlas holds the
+ * ink bytes (0 is black) then the mask bytes (1 is cleared to white).
+ */
+
+#define ASSETS_ICON_SIZE (ASSETS_ICON_WIDTH / 8 * ASSETS_ICON_HEIGHT)
+
+#define ASSETS_CODEC_RAW 0
+#define ASSETS_CODEC_RLE 1
+#define ASSETS_CODEC_LZ  2
+
+#define ASSETS_LZ_WINDOW 256
+
+typedef struct {
+  uint32_t offset;
+  uint16_t size;
+  uint8_t codec;
+} assets_blob_t;
+
+typedef struct {
+  int8_t top, bottom;   /* Rows, inclusive. Empty if top > bottom */
+  int8_t left, right;   /* Byte columns, inclusive */
+  uint32_t offset;      /* Into the atlas */
+} assets_glyph_t;
+
+extern const assets_blob_t assets_icons[ASSETS_ICON_COUNT];
+extern const uint8_t assets_icon_data[];
+
+extern const uint8_t assets_glyph_widths[ASSETS_GLYPH_COUNT];
+extern const assets_glyph_t
+  assets_glyphs[ASSETS_GLYPH_COUNT][ASSETS_GLYPH_VARIANTS];
+extern const uint8_t assets_glyph_atlas[];
+
+typedef struct {
+  const uint8_t* src;
+  const uint8_t* end;
+  uint8_t codec;
+  uint8_t op;         /* What the rest of the current token does */
+  uint8_t count;      /* Bytes left in the current token */
+  uint8_t arg;        /* RLE byte, or LZ distance-1 */
+  uint8_t wpos;       /* Next position in the LZ window */
+  uint8_t window[ASSETS_LZ_WINDOW];
+} assets_reader_t;
+
+/* Start decoding an icon, given its ASSETS_ICON_ index. */
+void assets_icon_open(assets_reader_t* r, int icon);
+
+/* Decode the next len bytes. Returns the number of bytes decoded,
+ * which is less than len only at the end of the icon.
+ */
+int assets_read(assets_reader_t* r, uint8_t* buf, int len);
+
+#endif
@@ -0,0 +1,173 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "rom/crc.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "xtensa/hal.h"
+#else
+#include <time.h>
+#endif
+
+#include "e-ink.h"
+#include "forecast_graphics.h"
+#include "icons.h"
+#include "text.h"
+
+/* Each case runs for at least this long */
+#define BENCH_MIN_NS (50*1000*1000LL)
+
+typedef struct {
+  const char* name;
+  int x;
+  int y;
+  const char* s;
+  int radj;
+} bench_text_t;
+
+/* The string is drawn with (x,y) as its bottom-left corner, or
+ * bottom-right if right-adjusted. A glyph cell reaches 16 pixels left
+ * of and below its origin, and 48 above. */
+static const bench_text_t g_text_cases[] =
+  {
+   {"glyph/shift0", 40, 130, "8", 0},
+   {"glyph/shift1", 41, 130, "8", 0},
+   {"glyph/shift2", 42, 130, "8", 0},
+   {"glyph/shift3", 43, 130, "8", 0},
+   {"glyph/shift4", 44, 130, "8", 0},
+   {"glyph/shift5", 45, 130, "8", 0},
+   {"glyph/shift6", 46, 130, "8", 0},
+   {"glyph/shift7", 47, 130, "8", 0},
+   {"glyph/clip_left", -3, 130, "8", 0},
+   {"glyph/clip_right", 173, 130, "8", 0},
+   {"glyph/clip_top", 40, 30, "8", 0},
+   {"glyph/clip_bottom", 40, 198, "8", 0},
+   {"text/-88", 0, 198, "-88", 0},
+   {"text/-88_radj", 200, 198, "-88", 1},
+   {"text/-8", 0, 198, "-8", 0},
+   {"text/0", 200, 198, "0", 1},
+  };
+
+typedef struct {
+  const char* name;
+  forecast_t forecast;
+} bench_forecast_t;
+
+/* One condition code for each icon */
+static const bench_forecast_t g_forecast_cases[] =
+  {
+   {"forecast/sun", {1, 1000, -88, 88}},
+   {"forecast/moon", {0, 1000, -88, 88}},
+   {"forecast/cloudy", {1, 1003, -88, 88}},
+   {"forecast/mist", {1, 1030, -88, 88}},
+   {"forecast/light_rain", {1, 1063, -88, 88}},
+   {"forecast/medium_hail", {1, 1237, -88, 88}},
+   {"forecast/medium_rain", {1, 1189, -88, 88}},
+   {"forecast/medium_sleet", {1, 1069, -88, 88}},
+   {"forecast/medium_snow", {1, 1066, -88, 88}},
+   {"forecast/heavy_rain", {1, 1195, -88, 88}},
+   {"forecast/heavy_hail", {1, 1264, -88, 88}},
+   {"forecast/heavy_snow", {1, 1225, -88, 88}},
+   {"forecast/storm", {1, 1087, -88, 88}},
+  };
+
+typedef void (*bench_fn_t)(uint8_t* buf, const void* arg);
+
+static int64_t bench_time_ns(void) {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time() * 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void bench_text(uint8_t* buf, const void* arg) {
+  const bench_text_t* c = arg;
+  draw_text(buf, EPD_WIDTH, EPD_HEIGHT, c->x, c->y, c->s, c->radj);
+}
+
+static void bench_forecast(uint8_t* buf, const void* arg) {
+  const bench_forecast_t* c = arg;
+  render_forecast(buf, &c->forecast);
+}
+
+/* Run a case until it has taken long enough to time, and print the
+ * result. */
+static void bench_case(const char* name, int glyphs, bench_fn_t fn,
+                       const void* arg, uint8_t* buf) {
+  static const uint8_t zero_state[TEXT_GLYPH_COUNT] = {0};
+  uint32_t crc;
+  uint32_t iters = 1;
+  int64_t start, elapsed;
+#ifdef ESP_PLATFORM
+  uint32_t cycles;
+#endif
+
+  /* The output, for spotting changes */
+  text_set_glyph_state(zero_state);
+  memset(buf, 0xFF, EPD_FRAME_SIZE);
+  fn(buf, arg);
+  crc = crc32_le(0, buf, EPD_FRAME_SIZE);
+
+  for (;;) {
+#ifdef ESP_PLATFORM
+    cycles = xthal_get_ccount();
+#endif
+    start = bench_time_ns();
+    for (uint32_t i = 0; i < iters; ++i)
+      fn(buf, arg);
+    elapsed = bench_time_ns() - start;
+#ifdef ESP_PLATFORM
+    cycles = xthal_get_ccount() - cycles;
+#endif
+    if (elapsed >= BENCH_MIN_NS)
+      break;
+    iters *= 2;
+  }
+
+  printf("{\"name\":\"%s\",\"iters\":%u,\"ns_per_op\":%lld",
+         name, iters, (long long)(elapsed / iters));
+  if (glyphs > 0)
+    printf(",\"ns_per_glyph\":%lld", (long long)(elapsed / iters / glyphs));
+#ifdef ESP_PLATFORM
+  printf(",\"cycles_per_op\":%u", cycles / iters);
+#endif
+  printf(",\"crc\":\"%08x\"}\n", crc);
+
+#ifdef ESP_PLATFORM
+  /* Let the idle task run, or the watchdog fires */
+  vTaskDelay(1);
+#endif
+}
+
+void bench_run(void) {
+  uint8_t glyph_state[TEXT_GLYPH_COUNT];
+  uint8_t* buf;
+
+  buf = malloc(EPD_FRAME_SIZE);
+  if (buf == NULL)
+    return;
+  text_get_glyph_state(glyph_state);
+
+  for (int i = 0; i < sizeof(g_text_cases)/sizeof(g_text_cases[0]); ++i) {
+    const bench_text_t* c = &g_text_cases[i];
+    bench_case(c->name, strlen(c->s), bench_text, c, buf);
+  }
+  for (int i = 0;
+       i < sizeof(g_forecast_cases)/sizeof(g_forecast_cases[0]); ++i) {
+    const bench_forecast_t* c = &g_forecast_cases[i];
+    bench_case(c->name, 0, bench_forecast, c, buf);
+  }
+
+  text_set_glyph_state(glyph_state);
+  free(buf);
+}
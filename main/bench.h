@@ -0,0 +1,22 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* Micro-benchmarks of the rendering hot path.
+ *
+ * Times draw_text on single glyphs at every x shift and clipped at
+ * each edge of the frame, on worst-case strings, and render_forecast
+ * on every icon. The display is not touched.
+ *
+ * Results are printed to stdout, one JSON object per line:
+ *
+ *   {"name":"glyph/shift3","iters":4096,"ns_per_op":1520,
+ *    "ns_per_glyph":1520,"crc":"1c2f09e3"}
+ *
+ * On the ESP32 a "cycles_per_op" field is added. The crc is of the
+ * frame buffer after one call from a blank frame with the glyph state
+ * reset, so that changes to the renderer's output show up too. The
+ * glyph state is restored afterwards.
+ */
+void bench_run(void);
+
+#endif
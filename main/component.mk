@@ -5,8 +5,8 @@
 
 COMPONENT_SRCDIRS := .
 
-#Compile image file into the resulting firmware binary
-COMPONENT_EMBED_FILES := \
+# The icons, in the order of the generated ASSETS_ICON_ indexes
+ASSET_ICONS := \
   images/sun.raw \
   images/moon.raw \
   images/cloudy.raw \
@@ -19,5 +19,21 @@ COMPONENT_EMBED_FILES := \
   images/heavy_hail.raw \
   images/heavy_rain.raw \
   images/heavy_snow.raw \
-  images/storm.raw \
-  images/glyphs.raw
+  images/storm.raw
+ASSET_GLYPHS := images/glyphs.raw images/glyphs.txt
+GEN_ASSETS := $(COMPONENT_PATH)/../tools/gen_assets.py
+
+COMPONENT_EXTRA_INCLUDES := $(COMPONENT_BUILD_DIR)
+COMPONENT_EXTRA_CLEAN := assets_gen.h assets_gen.inc
+
+# Generate the compressed icons and the glyph atlas. Every object that
+# includes assets.h, directly or through icons.h, needs them first.
+assets.o icons.o text.o forecast_graphics.o bench.o: \
+  assets_gen.h assets_gen.inc
+
+assets_gen.inc: assets_gen.h
+
+assets_gen.h: $(GEN_ASSETS) \
+  $(addprefix $(COMPONENT_PATH)/,$(ASSET_GLYPHS) $(ASSET_ICONS))
+	cd $(COMPONENT_PATH) && $(PYTHON) $(GEN_ASSETS) $(COMPONENT_BUILD_DIR) \
+	  $(ASSET_GLYPHS) $(ASSET_ICONS)
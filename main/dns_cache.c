@@ -0,0 +1,265 @@
+#include "dns_cache.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/dns.h"
+#include "lwip/netdb.h"
+
+#include "rtc_state.h"
+
+#define TAG "fc"
+
+#define DNS_PORT 53
+#define DNS_TIMEOUT_MS 2000
+/* Plain UDP answers are at most this long */
+#define DNS_MSG_MAX 512
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_A 1
+#define DNS_TYPE_CNAME 5
+#define DNS_CLASS_IN 1
+
+/* How long to keep an address from getaddrinfo, which doesn't give the
+ * TTL */
+#define DNS_DEFAULT_TTL 300
+
+static int64_t now_s(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec;
+}
+
+static uint16_t get16(const uint8_t* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return (uint32_t)get16(p) << 16 | get16(p+2);
+}
+
+/* Skip the name at p. Returns what follows it, or NULL if it runs past
+ * the end. */
+static const uint8_t* skip_name(const uint8_t* p, const uint8_t* end) {
+  while (p < end) {
+    if (*p == 0)
+      return p+1;
+    if ((*p & 0xC0) == 0xC0)
+      return p+2 <= end ? p+2 : NULL;
+    p += *p + 1;
+  }
+  return NULL;
+}
+
+/* Build a query for the A record of host. Returns its length, or 0 if
+ * the name is malformed. */
+static int build_query(uint8_t* msg, uint16_t id, const char* host) {
+  uint8_t* p = msg + DNS_HEADER_SIZE;
+
+  memset(msg, 0, DNS_HEADER_SIZE);
+  msg[0] = id >> 8;
+  msg[1] = id;
+  msg[2] = 0x01; /* Recursion desired */
+  msg[5] = 1;    /* One question */
+
+  while (*host) {
+    const char* dot = strchr(host, '.');
+    size_t len = dot != NULL ? (size_t)(dot - host) : strlen(host);
+    if (len == 0 || len > 63 || p + len + 6 > msg + DNS_MSG_MAX)
+      return 0;
+    *p++ = len;
+    memcpy(p, host, len);
+    p += len;
+    host += len;
+    if (*host == '.')
+      ++host;
+  }
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = DNS_TYPE_A;
+  *p++ = 0;
+  *p++ = DNS_CLASS_IN;
+  return p - msg;
+}
+
+/* Find the first A record of the answer. The TTL is the lowest one of
+ * the records leading to it, so a CNAME that expires first counts. */
+static esp_err_t parse_answer(const uint8_t* msg, int len, uint16_t id,
+                              uint32_t* addr, uint32_t* ttl) {
+  const uint8_t* end = msg + len;
+  const uint8_t* p = msg + DNS_HEADER_SIZE;
+  uint32_t min_ttl = UINT32_MAX;
+  int questions, answers;
+
+  /* Our ID, a response, and no error */
+  if (len < DNS_HEADER_SIZE || get16(msg) != id || !(msg[2] & 0x80)
+      || (msg[3] & 0x0F) != 0)
+    return ESP_FAIL;
+  questions = get16(msg+4);
+  answers = get16(msg+6);
+
+  while (questions-- > 0) {
+    p = skip_name(p, end);
+    if (p == NULL || p+4 > end)
+      return ESP_FAIL;
+    p += 4;
+  }
+
+  while (answers-- > 0) {
+    uint16_t type, class, rdlen;
+    uint32_t rttl;
+
+    p = skip_name(p, end);
+    if (p == NULL || p+10 > end)
+      return ESP_FAIL;
+    type = get16(p);
+    class = get16(p+2);
+    rttl = get32(p+4);
+    rdlen = get16(p+8);
+    p += 10;
+    if (p + rdlen > end)
+      return ESP_FAIL;
+
+    if (class == DNS_CLASS_IN
+        && (type == DNS_TYPE_A || type == DNS_TYPE_CNAME) && rttl < min_ttl)
+      min_ttl = rttl;
+    if (class == DNS_CLASS_IN && type == DNS_TYPE_A && rdlen == 4) {
+      /* Already in network order, like in_addr */
+      memcpy(addr, p, 4);
+      *ttl = min_ttl;
+      return ESP_OK;
+    }
+    p += rdlen;
+  }
+  return ESP_FAIL;
+}
+
+/* Milliseconds left until deadline, at most DNS_TIMEOUT_MS */
+static int32_t time_left_ms(int64_t deadline) {
+  int64_t left = (deadline - esp_timer_get_time()) / 1000;
+
+  if (left < 0)
+    return 0;
+  return left < DNS_TIMEOUT_MS ? (int32_t)left : DNS_TIMEOUT_MS;
+}
+
+/* Ask the DNS server for the A record of host ourselves, as lwIP keeps
+ * the TTL to itself. Waits for the answer until deadline, at most
+ * DNS_TIMEOUT_MS. */
+static esp_err_t dns_query(const char* host, uint32_t* addr, uint32_t* ttl,
+                           int64_t deadline) {
+  const ip_addr_t* server = dns_getserver(0);
+  struct sockaddr_in sa =
+    {
+     .sin_family = AF_INET,
+     .sin_port = htons(DNS_PORT),
+    };
+  int32_t wait = time_left_ms(deadline);
+  struct timeval timeout =
+    {
+     .tv_sec = wait / 1000,
+     .tv_usec = wait % 1000 * 1000,
+    };
+  uint8_t msg[DNS_MSG_MAX];
+  uint16_t id = esp_random();
+  esp_err_t ret = ESP_FAIL;
+  int s, len;
+
+  /* A zero timeout would wait forever */
+  if (wait == 0)
+    return ESP_FAIL;
+  if (server == NULL || IP_GET_TYPE(server) != IPADDR_TYPE_V4
+      || ip_2_ip4(server)->addr == 0)
+    return ESP_FAIL;
+  sa.sin_addr.s_addr = ip_2_ip4(server)->addr;
+
+  len = build_query(msg, id, host);
+  if (len == 0)
+    return ESP_FAIL;
+
+  s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s < 0)
+    return ESP_FAIL;
+  if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+    goto out;
+  if (sendto(s, msg, len, 0, (struct sockaddr*)&sa, sizeof(sa)) != len)
+    goto out;
+  len = recv(s, msg, sizeof(msg), 0);
+  if (len > 0)
+    ret = parse_answer(msg, len, id, addr, ttl);
+
+ out:
+  close(s);
+  return ret;
+}
+
+/* The regular lookup, when our own query didn't work out */
+static esp_err_t dns_lookup(const char* host, uint32_t* addr) {
+  const struct addrinfo hints =
+    {
+     .ai_family = AF_INET,
+     .ai_socktype = SOCK_STREAM,
+    };
+  struct addrinfo *res;
+  int err;
+
+  err = getaddrinfo(host, NULL, &hints, &res);
+  if (err != 0 || res == NULL) {
+    ESP_LOGE(TAG, "DNS lookup failed err=%d res=%p", err, res);
+    return ESP_FAIL;
+  }
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(res);
+  return ESP_OK;
+}
+
+esp_err_t dns_cache_resolve(const char* host, struct in_addr* addr,
+                            int* cached, int64_t deadline) {
+  rtc_state_t* state = rtc_state();
+  int64_t now = now_s();
+  int64_t start;
+  uint32_t ttl;
+
+  /* Nothing to look up, e.g. for a local test server */
+  if (inet_aton(host, addr)) {
+    *cached = 0;
+    return ESP_OK;
+  }
+
+  if (state->dns_addr != 0 && now < state->dns_expires) {
+    addr->s_addr = state->dns_addr;
+    *cached = 1;
+    ESP_LOGI(TAG, "DNS cache hit: %s is %s for another %d s", host,
+             inet_ntoa(*addr), (int)(state->dns_expires - now));
+    return ESP_OK;
+  }
+
+  *cached = 0;
+  start = esp_timer_get_time();
+  if (dns_query(host, &addr->s_addr, &ttl, deadline) != ESP_OK) {
+    /* getaddrinfo can't be cut short, so only try it with the time for
+     * a whole query left */
+    if (time_left_ms(deadline) < DNS_TIMEOUT_MS) {
+      ESP_LOGE(TAG, "DNS query failed, no time left for getaddrinfo");
+      return ESP_FAIL;
+    }
+    ESP_LOGW(TAG, "DNS query failed, falling back to getaddrinfo");
+    if (dns_lookup(host, &addr->s_addr) != ESP_OK)
+      return ESP_FAIL;
+    ttl = DNS_DEFAULT_TTL;
+  }
+  if (ttl > CONFIG_DNS_CACHE_MAX_TTL)
+    ttl = CONFIG_DNS_CACHE_MAX_TTL;
+
+  state->dns_addr = addr->s_addr;
+  state->dns_expires = now + ttl;
+  ESP_LOGI(TAG, "DNS lookup: %s is %s, took %u ms, caching for %u s", host,
+           inet_ntoa(*addr), (uint32_t)((esp_timer_get_time() - start) / 1000),
+           ttl);
+  return ESP_OK;
+}
+
+void dns_cache_invalidate(void) {
+  rtc_state()->dns_addr = 0;
+}
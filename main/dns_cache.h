@@ -0,0 +1,25 @@
+#ifndef __DNS_CACHE_H__
+#define __DNS_CACHE_H__
+
+#include "esp_system.h"
+#include "lwip/sockets.h"
+
+/* Resolve the forecast server, remembering the answer in RTC memory
+ * until its TTL runs out, so most wakes skip the DNS round trip.
+ *
+ * The cache relies on the system time, which keeps running through
+ * deep sleep.
+ */
+
+/* Resolve host into addr. Uses the cached address while it is valid,
+ * otherwise queries the DNS server and caches the answer. cached is
+ * set to 1 if the address came from the cache. A lookup fails at the
+ * latest at deadline, in esp_timer microseconds.
+ */
+esp_err_t dns_cache_resolve(const char* host, struct in_addr* addr,
+                            int* cached, int64_t deadline);
+
+/* Drop the cached address, e.g. after failing to connect to it. */
+void dns_cache_invalidate(void);
+
+#endif
@@ -8,12 +8,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
 #include "esp_system.h"
-#include "driver/spi_master.h"
-#include "soc/gpio_struct.h"
-#include "driver/gpio.h"
+
+#include "epd_hal.h"
 
 #define DRIVER_OUTPUT_CONTROL                       0x01
 #define BOOSTER_SOFT_START_CONTROL                  0x0C
@@ -37,19 +36,23 @@
 #define SET_RAM_Y_ADDRESS_COUNTER                   0x4F
 #define TERMINATE_FRAME_READ_WRITE                  0xFF
 
-/* We need to remember the D/C pin and BUSY pin GPIO number.
- * Store them as a global variables.
+/* Give up waiting for BUSY after this long. A full update takes about
+ * two seconds.
  */
-static int g_epd_dc_pin;
-static int g_epd_busy_pin;
+#define EPD_BUSY_TIMEOUT_MS 5000
+
+static const char* TAG = "epd";
 
-/* We keep a handle to the SPI device here.
+/* Ping-pong buffers for epd_set_frame_memory_bands, sent by DMA. All
+ * panels share them, so calls for different panels mustn't run at the
+ * same time.
  */
-static spi_device_handle_t g_spi;
+static WORD_ALIGNED_ATTR uint8_t g_bands[2][EPD_BAND_SIZE];
 
-/* Lookup tables sent to the display.
+/* Lookup tables sent to the display. Placed in DRAM so that DMA can
+ * read them.
  */
-const uint8_t lut_full_update[] =
+DRAM_ATTR const uint8_t lut_full_update[] =
 {
     0x02, 0x02, 0x01, 0x11, 0x12, 0x12, 0x22, 0x22,
     0x66, 0x69, 0x69, 0x59, 0x58, 0x99, 0x99, 0x88,
@@ -57,7 +60,7 @@ const uint8_t lut_full_update[] =
     0x35, 0x51, 0x51, 0x19, 0x01, 0x00
 };
 
-const uint8_t lut_partial_update[] =
+DRAM_ATTR const uint8_t lut_partial_update[] =
 {
     0x10, 0x18, 0x18, 0x08, 0x18, 0x18, 0x08, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -91,97 +94,147 @@ DRAM_ATTR static const epd_init_cmd_t epd_init_cmds[] =
 
 /* Wait for the device to deassert BUSY.
  */
-void epd_wait_busy()
+esp_err_t epd_wait_busy(epd_t* epd)
 {
-  while(gpio_get_level(g_epd_busy_pin)) {/* No-op */}
+  esp_err_t ret = ESP_OK;
+  int64_t start;
+
+  epd_hal_flush(epd->hal);
+  start = epd_hal_time_us();
+
+  if (epd_hal_busy(epd->hal)) {
+    if (epd->busy_stuck)
+      return ESP_ERR_TIMEOUT;
+    ret = epd_hal_wait_busy(epd->hal, EPD_BUSY_TIMEOUT_MS);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Timed out waiting for BUSY");
+      ++epd->stats.busy_timeouts;
+      epd->busy_stuck = 1;
+    }
+  }
+
+  epd->busy_pending = 0;
+  epd->stats.busy_us += epd_hal_time_us() - start;
+  return ret;
 }
 
-/* Send a command to the display. Uses spi_device_polling_transmit,
- * which waits until the transfer is complete.
- *
- * Since command transactions are usually small, they are handled in
- * polling mode for higher speed. The overhead of interrupt
- * transactions is more than just waiting for the transaction to
- * complete.
+/* Send a command to the display. If an earlier command made the
+ * display busy, wait for it first, as the display ignores commands
+ * while it is busy.
  */
-static void epd_send_command(const uint8_t cmd)
+static void epd_send_command(epd_t* epd, const uint8_t cmd)
 {
-    esp_err_t ret;
-    spi_transaction_t t;
-    memset(&t, 0, sizeof(t));         // Zero out the transaction
-    t.length = 8;                     // Command is 8 bits
-    t.tx_buffer = &cmd;               // The data is the cmd itself
-    t.user = (void*)0;                // D/C needs to be set to 0
-    epd_wait_busy();
-    ret = spi_device_polling_transmit(g_spi, &t); // Transmit!
-    assert(ret == ESP_OK);            // Should have had no issues.
+  if (epd->busy_pending)
+    epd_wait_busy(epd);
+  epd->stats.transactions += epd_hal_write(epd->hal, &cmd, 1, 0);
+  epd->stats.bytes += 1;
+  if (cmd == MASTER_ACTIVATION || cmd == SW_RESET || cmd == DEEP_SLEEP_MODE)
+    epd->busy_pending = 1;
 }
 
-/* Send data to the display. Uses spi_device_polling_transmit, which waits
- * until the transfer is complete.
- *
- * Since data transactions are usually small, they are handled in
- * polling mode for higher speed. The overhead of interrupt
- * transactions is more than just waiting for the transaction to
- * complete.
+/* Queue data to the display. Short data is copied, longer data must
+ * stay valid until epd_hal_flush.
+ */
+static void epd_send_data(epd_t* epd, const uint8_t* data, int len) {
+  epd->stats.transactions += epd_hal_write(epd->hal, data, len, 1);
+  epd->stats.bytes += len;
+}
+
+/* Send a command with its arguments.
+ */
+static void epd_send_command_args(epd_t* epd, uint8_t cmd,
+                                  const uint8_t* args, int len)
+{
+  epd_send_command(epd, cmd);
+  epd_send_data(epd, args, len);
+}
+
+/* Send rows of a buffer with the given stride.
+ */
+static void epd_send_rows(epd_t* epd, const uint8_t* src, int stride,
+                          int row_bytes, int rows)
+{
+  epd->stats.transactions += epd_hal_write_rows(epd->hal, src, stride,
+                                                row_bytes, rows);
+  epd->stats.bytes += row_bytes * rows;
+}
+
+/* Send the same byte a number of times.
  */
-static void epd_send_data(const uint8_t* data, int len) {
-  esp_err_t ret;
-  spi_transaction_t t;
-  if (len == 0) return;             // No need to send anything
-  memset(&t, 0, sizeof(t));         // Zero out the transaction
-  t.length = len*8;                 // Len is in bytes, transaction
-                                    // length is in bits.
-  t.tx_buffer = data;               // Data
-  t.user = (void*)1;                // D/C needs to be set to 1
-  ret = spi_device_polling_transmit(g_spi, &t); // Transmit!
-  assert(ret == ESP_OK);            // Should have had no issues.
+static void epd_send_fill(epd_t* epd, uint8_t color, int len)
+{
+  epd->stats.transactions += epd_hal_write_fill(epd->hal, color, len);
+  epd->stats.bytes += len;
 }
 
-/* Send one byte of data to the display.
+/* Start and end of each public call, for the statistics. All queued
+ * transactions complete before the call returns, so callers are free
+ * to reuse their buffers.
  */
-static void epd_send_byte(uint8_t data) {
-  esp_err_t ret;
-  spi_transaction_t t;
-  memset(&t, 0, sizeof(t));         // Zero out the transaction
-  t.length = 8;                     // One byte is eight bits.
-  t.tx_buffer = &data;              // Data
-  t.user = (void*)1;                // D/C needs to be set to 1
-  ret = spi_device_polling_transmit(g_spi, &t); // Transmit!
-  assert(ret == ESP_OK);            // Should have had no issues.
+typedef struct {
+  int64_t start;
+  int64_t busy_us;
+  uint32_t transactions;
+  uint32_t bytes;
+} epd_call_t;
+
+static void epd_call_begin(epd_t* epd, epd_call_t* call)
+{
+  call->start = epd_hal_time_us();
+  call->busy_us = epd->stats.busy_us;
+  call->transactions = epd->stats.transactions;
+  call->bytes = epd->stats.bytes;
+}
+
+static void epd_call_end(epd_t* epd, const char* name,
+                         const epd_call_t* call)
+{
+  int64_t busy_us, spi_us;
+
+  epd_hal_flush(epd->hal);
+  busy_us = epd->stats.busy_us - call->busy_us;
+  spi_us = epd_hal_time_us() - call->start - busy_us;
+  ++epd->stats.calls;
+  epd->stats.spi_us += spi_us;
+  ESP_LOGD(TAG, "%s: %u transactions, %u bytes, %u us (+%u us busy)", name,
+           epd->stats.transactions - call->transactions,
+           epd->stats.bytes - call->bytes,
+           (uint32_t)spi_us, (uint32_t)busy_us);
 }
 
 /**
  *  @brief: specify the memory area for data R/W
  */
-static void epd_set_memory_area(int x_start, int y_start, int x_end, int y_end) {
-  epd_send_command(SET_RAM_X_ADDRESS_START_END_POSITION);
-  epd_send_byte((x_start >> 3) & 0xFF);
-  epd_send_byte((x_end >> 3) & 0xFF);
-  epd_send_command(SET_RAM_Y_ADDRESS_START_END_POSITION);
-  epd_send_byte(y_start & 0xFF);
-  epd_send_byte((y_start >> 8) & 0xFF);
-  epd_send_byte(y_end & 0xFF);
-  epd_send_byte((y_end >> 8) & 0xFF);
+static void epd_set_memory_area(epd_t* epd, int x_start, int y_start,
+                                int x_end, int y_end) {
+  const uint8_t x[] = {(x_start >> 3) & 0xFF, (x_end >> 3) & 0xFF};
+  const uint8_t y[] = {y_start & 0xFF, (y_start >> 8) & 0xFF,
+                       y_end & 0xFF, (y_end >> 8) & 0xFF};
+  epd_send_command_args(epd, SET_RAM_X_ADDRESS_START_END_POSITION,
+                        x, sizeof(x));
+  epd_send_command_args(epd, SET_RAM_Y_ADDRESS_START_END_POSITION,
+                        y, sizeof(y));
 }
 
 /**
  *  @brief: specify the start point for data R/W
  */
-static void epd_set_memory_pointer(int x, int y) {
-  epd_send_command(SET_RAM_X_ADDRESS_COUNTER);
-  epd_send_byte((x >> 3) & 0xFF);
-  epd_send_command(SET_RAM_Y_ADDRESS_COUNTER);
-  epd_send_byte(y & 0xFF);
-  epd_send_byte((y >> 8) & 0xFF);
+static void epd_set_memory_pointer(epd_t* epd, int x, int y) {
+  const uint8_t xc[] = {(x >> 3) & 0xFF};
+  const uint8_t yc[] = {y & 0xFF, (y >> 8) & 0xFF};
+  epd_send_command_args(epd, SET_RAM_X_ADDRESS_COUNTER, xc, sizeof(xc));
+  epd_send_command_args(epd, SET_RAM_Y_ADDRESS_COUNTER, yc, sizeof(yc));
 }
 
 /**
  *  @brief: set the look-up table register
  */
-void epd_set_lut(const uint8_t* lut) {
-  epd_send_command(WRITE_LUT_REGISTER);
-  epd_send_data(&lut[0], 30);
+void epd_set_lut(epd_t* epd, const uint8_t* lut) {
+  epd_call_t call;
+  epd_call_begin(epd, &call);
+  epd_send_command_args(epd, WRITE_LUT_REGISTER, lut, 30);
+  epd_call_end(epd, __func__, &call);
+  epd->lut = lut;
 }
 
 /**
@@ -190,19 +243,23 @@ void epd_set_lut(const uint8_t* lut) {
  *          The deep sleep mode would return to standby by hardware reset.
  *          You can use epd_init to awaken.
  */
-void epd_sleep() {
-  epd_send_command(DEEP_SLEEP_MODE);
+void epd_sleep(epd_t* epd) {
+  epd_call_t call;
+  epd_call_begin(epd, &call);
+  epd_send_command(epd, DEEP_SLEEP_MODE);
+  epd_call_end(epd, __func__, &call);
 }
 
 /**
  *  @brief: Put a partial image buffer to the frame memory.
  *          this won't update the display.
  */
-void epd_set_partial_frame_memory(const uint8_t* image_buffer,
+void epd_set_partial_frame_memory(epd_t* epd, const uint8_t* image_buffer,
                                   int x, int y,
                                   int image_width, int image_height) {
   int x_end;
   int y_end;
+  epd_call_t call;
 
   if (image_buffer == NULL || x < 0 || image_width < 0
       || y < 0 || image_height < 0) {
@@ -221,39 +278,65 @@ void epd_set_partial_frame_memory(const uint8_t* image_buffer,
   } else {
     y_end = y + image_height - 1;
   }
-  epd_set_memory_area(x, y, x_end, y_end);
-  epd_set_memory_pointer(x, y);
-  epd_send_command(WRITE_RAM);
-
-  for (int j = 0; j < y_end - y + 1; j++) {
-    for (int i = 0; i < (x_end - x + 1) / 8; i++) {
-      epd_send_byte(image_buffer[i + j * (image_width / 8)]);
-    }
-  }
+  epd_call_begin(epd, &call);
+  epd_set_memory_area(epd, x, y, x_end, y_end);
+  epd_set_memory_pointer(epd, x, y);
+  epd_send_command(epd, WRITE_RAM);
+  epd_send_rows(epd, image_buffer, image_width / 8,
+                (x_end - x + 1) / 8, y_end - y + 1);
+  epd_call_end(epd, __func__, &call);
 }
 
 /**
- *  @brief: Put an image buffer to the frame memory.
+ *  @brief: Put a window of the frame memory, produced band by band.
  *          this won't update the display.
  */
-void epd_set_frame_memory(const uint8_t* image_buffer) {
-  epd_set_memory_area(0, 0, EPD_WIDTH - 1, EPD_HEIGHT - 1);
-  epd_set_memory_pointer(0, 0);
-  epd_send_command(WRITE_RAM);
-  epd_send_data(image_buffer, EPD_WIDTH / 8 * EPD_HEIGHT);
+void epd_set_frame_memory_bands(epd_t* epd, int x, int y, int width,
+                                int height, epd_band_fn_t fn, void* ctx) {
+  int x_end = (x + width + 7) & ~7;
+  int y_end = y + height;
+  int in_flight = 0;
+  epd_call_t call;
+
+  x &= ~7;
+  if (x < 0) x = 0;
+  if (y < 0) y = 0;
+  if (x_end > EPD_WIDTH) x_end = EPD_WIDTH;
+  if (y_end > EPD_HEIGHT) y_end = EPD_HEIGHT;
+  if (x >= x_end || y >= y_end)
+    return;
+
+  epd_call_begin(epd, &call);
+  epd_set_memory_area(epd, x, y, x_end - 1, y_end - 1);
+  epd_set_memory_pointer(epd, x, y);
+  epd_send_command(epd, WRITE_RAM);
+  for (int k = 0; y < y_end; y += EPD_BAND_ROWS, k ^= 1) {
+    int rows = y_end - y < EPD_BAND_ROWS ? y_end - y : EPD_BAND_ROWS;
+
+    /* This buffer went out two bands ago; only the transactions of
+     * the last band may still use the other one */
+    epd_hal_sync(epd->hal, in_flight);
+    fn(ctx, g_bands[k], y, rows);
+    in_flight = epd_hal_write_rows(epd->hal, g_bands[k] + x / 8,
+                                   EPD_WIDTH / 8, (x_end - x) / 8, rows);
+    epd->stats.transactions += in_flight;
+    epd->stats.bytes += (x_end - x) / 8 * rows;
+  }
+  epd_call_end(epd, __func__, &call);
 }
 
 /**
  *  @brief: Clear the frame memory with the specified color.
  *          This won't update the display.
  */
-void epd_clear_frame_memory(uint8_t color) {
-  epd_set_memory_area(0, 0, EPD_WIDTH - 1, EPD_HEIGHT - 1);
-  epd_set_memory_pointer(0, 0);
-  epd_send_command(WRITE_RAM);
-  for (int i = 0; i < EPD_WIDTH / 8 * EPD_HEIGHT; i++) {
-    epd_send_byte(color);
-  }
+void epd_clear_frame_memory(epd_t* epd, uint8_t color) {
+  epd_call_t call;
+  epd_call_begin(epd, &call);
+  epd_set_memory_area(epd, 0, 0, EPD_WIDTH - 1, EPD_HEIGHT - 1);
+  epd_set_memory_pointer(epd, 0, 0);
+  epd_send_command(epd, WRITE_RAM);
+  epd_send_fill(epd, color, EPD_FRAME_SIZE);
+  epd_call_end(epd, __func__, &call);
 }
 
 /**
@@ -263,71 +346,84 @@ void epd_clear_frame_memory(uint8_t color) {
  *          SetFrameMemory or ClearFrame will set the other memory
  *          area.
  */
-void epd_display_frame() {
-  epd_send_command(DISPLAY_UPDATE_CONTROL_2);
-  epd_send_byte(0xC4);
-  epd_send_command(MASTER_ACTIVATION);
-  epd_send_command(TERMINATE_FRAME_READ_WRITE);
+void epd_display_frame(epd_t* epd) {
+  const uint8_t ctrl[] = {0xC4};
+  epd_call_t call;
+  epd_call_begin(epd, &call);
+  /* End the RAM write before the update rather than after, which would
+   * wait for the update to finish */
+  epd_send_command(epd, TERMINATE_FRAME_READ_WRITE);
+  epd_send_command_args(epd, DISPLAY_UPDATE_CONTROL_2, ctrl, sizeof(ctrl));
+  epd_send_command(epd, MASTER_ACTIVATION);
+  epd_call_end(epd, __func__, &call);
 }
 
-/**
- *  @brief: This function is called (in irq context!) just before a
- *          transmission starts. It will set the D/C line to the value
- *          indicated in the user field.
- */
-static void epd_spi_pre_transfer_callback(spi_transaction_t *t)
-{
-  int dc = (int)t->user;
-  gpio_set_level(g_epd_dc_pin, dc);
+void epd_get_stats(epd_t* epd, epd_stats_t* stats) {
+  *stats = epd->stats;
 }
 
-/**
- *  @brief: Add the display as a device to the SPI bus.
- */
-esp_err_t epd_spi_bus_add(spi_host_device_t host,
-                          spi_device_handle_t* handle,
-                          int cs_pin) {
-  spi_device_interface_config_t devcfg =
-    {
-     .clock_speed_hz = 2*1000*1000,           // Clock out at 2 MHz
-     .mode = 0,                               // SPI mode 0
-     .spics_io_num = cs_pin,                  // CS pin
-     .queue_size = 7,                         // We want to be able to
-                                              // queue 7 transactions
-     .pre_cb = epd_spi_pre_transfer_callback, // Specify pre-transfer
-                                              // callback to handle D/C
-                                              // line
-    };
-
-  // Attach the display to the SPI bus
-  return spi_bus_add_device(HSPI_HOST, &devcfg, handle);
+void epd_reset_stats(epd_t* epd) {
+  memset(&epd->stats, 0, sizeof(epd->stats));
+}
+
+/* Time that each unit of a LUT phase length lasts, at the frame rate
+ * set by SET_DUMMY_LINE_PERIOD and SET_GATE_TIME in epd_init_cmds */
+#define EPD_LUT_UNIT_US 25000
+
+int epd_update_time_ms(epd_t* epd) {
+  int units = 0;
+
+  if (epd->lut == NULL)
+    return EPD_BUSY_TIMEOUT_MS;
+  /* Bytes 20 to 29 hold two phase lengths each */
+  for (int i = 20; i < 30; ++i)
+    units += (epd->lut[i] >> 4) + (epd->lut[i] & 0x0F);
+  return units * (EPD_LUT_UNIT_US / 1000);
+}
+
+esp_err_t epd_attach(epd_t* epd, epd_hal_spi_t spi, int dc_pin, int busy_pin)
+{
+  epd->hal = epd_hal_init(spi, dc_pin, busy_pin);
+  if (epd->hal == NULL) {
+    ESP_LOGE(TAG, "No room for another panel");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // The display may still be busy from power up or an earlier update
+  epd->busy_pending = 1;
+  epd->busy_stuck = 0;
+  epd->lut = NULL;
+  return ESP_OK;
 }
 
 /**
  *  @brief: Initialize the display.
  */
-void epd_init(spi_device_handle_t spi, const uint8_t* lut,
-              int dc_pin, int busy_pin)
+esp_err_t epd_init(epd_t* epd, epd_hal_spi_t spi, const uint8_t* lut,
+                   int dc_pin, int busy_pin)
 {
   int cmd = 0;
+  epd_call_t call;
+  esp_err_t err;
 
-  g_spi = spi;
-  g_epd_dc_pin = dc_pin;
-  g_epd_busy_pin = busy_pin;
-
-  // Initialize non-SPI GPIOs
-  gpio_set_direction(dc_pin, GPIO_MODE_OUTPUT);
-  gpio_set_direction(busy_pin, GPIO_MODE_INPUT);
+  err = epd_attach(epd, spi, dc_pin, busy_pin);
+  if (err != ESP_OK)
+    return err;
 
   printf("E-ink initialization.\n");
 
   // Send all the commands
+  epd_call_begin(epd, &call);
   while (epd_init_cmds[cmd].databytes != 0xff) {
-    epd_send_command(epd_init_cmds[cmd].cmd);
-    epd_send_data(epd_init_cmds[cmd].data,
-                  epd_init_cmds[cmd].databytes & 0x1F);
+    epd_send_command_args(epd, epd_init_cmds[cmd].cmd,
+                          epd_init_cmds[cmd].data,
+                          epd_init_cmds[cmd].databytes & 0x1F);
+    if (epd_init_cmds[cmd].databytes & 0x80)
+      epd_hal_delay_ms(100);
     cmd++;
   }
+  epd_call_end(epd, __func__, &call);
 
-  epd_set_lut(lut);
+  epd_set_lut(epd, lut);
+  return ESP_OK;
 }
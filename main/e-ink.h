@@ -9,23 +9,70 @@
 
 #include <stdint.h>
 
+#include "esp_system.h"
+
+#include "epd_hal.h"
+
+#ifdef ESP_PLATFORM
 #include "driver/spi_master.h"
+#endif
 
 #define EPD_WIDTH  200
 #define EPD_HEIGHT 200
 
+/* Bytes in a full frame, one bit per pixel */
+#define EPD_FRAME_SIZE (EPD_WIDTH / 8 * EPD_HEIGHT)
+
+/* Rows and bytes in a band, see epd_set_frame_memory_bands */
+#define EPD_BAND_ROWS 16
+#define EPD_BAND_SIZE (EPD_WIDTH / 8 * EPD_BAND_ROWS)
+
+/* Fill a band with full frame rows y to y+rows-1. */
+typedef void (*epd_band_fn_t)(void* ctx, uint8_t* band, int y, int rows);
+
+/* SPI transfer statistics, to see where the time goes */
+typedef struct {
+  uint32_t calls;         /* Public calls that talked to the display */
+  uint32_t transactions;  /* SPI transactions queued */
+  uint32_t bytes;         /* Bytes sent, commands included */
+  int64_t spi_us;         /* Time spent in calls, BUSY waits excluded */
+  int64_t busy_us;        /* Time spent waiting for BUSY */
+  uint32_t busy_timeouts; /* Waits for BUSY that timed out */
+} epd_stats_t;
+
+/* A panel, set up by epd_init and passed to every call. Each panel has
+ * its own pins, BUSY state and statistics, so several can share one
+ * SPI bus: one panel can be sent a frame while another is still busy
+ * updating, as BUSY is only waited for by the next command to the
+ * panel that is busy. Calls for different panels mustn't run at the
+ * same time, from different tasks.
+ */
+typedef struct {
+  epd_hal_t* hal;
+  /* Set after commands that make the display busy. Other commands are
+   * sent without checking BUSY at all. Once a wait has timed out, we
+   * stop waiting until the next epd_init, so that a dead display costs
+   * one timeout rather than one per command. */
+  uint8_t busy_pending;
+  uint8_t busy_stuck;
+  const uint8_t* lut; /* Loaded LUT, NULL if unknown */
+  epd_stats_t stats;
+} epd_t;
+
 extern const uint8_t lut_full_update[];
 extern const uint8_t lut_partial_update[];
 
 /**
- *  @brief: wait for the device to deassert BUSY.
+ *  @brief: wait for the device to deassert BUSY. The calling task
+ *          blocks on the BUSY interrupt. Returns ESP_ERR_TIMEOUT if
+ *          the display stays busy for too long.
  */
-void epd_wait_busy();
+esp_err_t epd_wait_busy(epd_t* epd);
 
 /**
  *  @brief: set the look-up table register
  */
-void epd_set_lut(const uint8_t* lut);
+void epd_set_lut(epd_t* epd, const uint8_t* lut);
 
 /**
  *  @brief: After this command is transmitted, the chip would enter the
@@ -33,47 +80,76 @@ void epd_set_lut(const uint8_t* lut);
  *          The deep sleep mode would return to standby by hardware reset.
  *          You can use epd_init to awaken.
  */
-void epd_sleep();
+void epd_sleep(epd_t* epd);
 
 /**
  *  @brief: Put a partial image buffer to the frame memory.
  *          this won't update the display.
  */
-void epd_set_partial_frame_memory(const uint8_t* image_buffer,
+void epd_set_partial_frame_memory(epd_t* epd, const uint8_t* image_buffer,
                                   int x, int y,
                                   int image_width, int image_height);
 /**
- *  @brief: Put an image buffer to the frame memory.
+ *  @brief: Put a window of the frame memory, produced band by band.
+ *          Each band is filled by fn into one of two DMA buffers and
+ *          sent while fn fills the next one, so no full frame buffer
+ *          is needed. Bands are produced in order from the top.
+ *          x and width are rounded to whole bytes.
  *          this won't update the display.
  */
-void epd_set_frame_memory(const uint8_t* image_buffer);
+void epd_set_frame_memory_bands(epd_t* epd, int x, int y, int width,
+                                int height, epd_band_fn_t fn, void* ctx);
 
 /**
  *  @brief: Clear the frame memory with the specified color.
  *          This won't update the display.
  */
-void epd_clear_frame_memory(uint8_t color);
+void epd_clear_frame_memory(epd_t* epd, uint8_t color);
 
 /**
  *  @brief: Update the display.
  *          There are 2 memory areas embedded in the e-paper display
  *          but once this function is called, the the next action of
  *          SetFrameMemory or ClearFrame will set the other memory
- *          area.
+ *          area. Returns as soon as the update has started; the next
+ *          command to this panel waits for it to finish.
  */
-void epd_display_frame();
+void epd_display_frame(epd_t* epd);
 
+#ifdef ESP_PLATFORM
 /**
- *  @brief: Add the display as a device to the SPI bus.
+ *  @brief: Add a display as a device to the SPI bus host.
  */
 esp_err_t epd_spi_bus_add(spi_host_device_t host,
                           spi_device_handle_t* handle,
-                          int cs_pin);
+                          int cs_pin, int clock_hz);
+#endif
+
+/**
+ *  @brief: Initialize the display on spi, with its D/C and BUSY pins.
+ *          Returns ESP_ERR_NO_MEM if there are already
+ *          EPD_HAL_MAX_PANELS other panels.
+ */
+esp_err_t epd_init(epd_t* epd, epd_hal_spi_t spi, const uint8_t* lut,
+                   int dc_pin, int busy_pin);
+
+/**
+ *  @brief: Take over a display initialized before deep sleep, without
+ *          resetting it, e.g. to finish with an update started then.
+ *          The display counts as busy until BUSY says otherwise.
+ */
+esp_err_t epd_attach(epd_t* epd, epd_hal_spi_t spi, int dc_pin, int busy_pin);
+
+/**
+ *  @brief: How long an update with the loaded LUT should take, in
+ *          milliseconds, from the phase lengths in the LUT.
+ */
+int epd_update_time_ms(epd_t* epd);
 
 /**
- *  @brief: Initialize the display.
+ *  @brief: Get or reset the SPI transfer statistics.
  */
-void epd_init(spi_device_handle_t spi, const uint8_t* lut,
-              int dc_pin, int busy_pin);
+void epd_get_stats(epd_t* epd, epd_stats_t* stats);
+void epd_reset_stats(epd_t* epd);
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef __EPD_HAL_H__
+#define __EPD_HAL_H__
+
+/* Hardware access for the e-ink driver.
+ *
+ * e-ink.c only talks to the panels through these functions: bytes out
+ * on SPI with the D/C level, the BUSY line, and time. Each panel has
+ * its own handle, with its own pins and queue. On the ESP32
+ * they are implemented by epd_hal_esp32.c on top of the SPI master
+ * and GPIO drivers; the host build implements them on a simulated
+ * panel instead.
+ */
+
+#include <stdint.h>
+
+#include "esp_system.h"
+
+/* Panels the driver can handle at once, on one or more SPI buses */
+#define EPD_HAL_MAX_PANELS 2
+
+/* The SPI device of a panel, as handed to epd_init. On the ESP32 this
+ * is the spi_device_handle_t from epd_spi_bus_add.
+ */
+typedef void* epd_hal_spi_t;
+
+/* A panel's hardware: its SPI device, pins, and the transfers queued
+ * to it. Defined by each implementation.
+ */
+typedef struct epd_hal epd_hal_t;
+
+/* Set up the D/C and BUSY pins of the panel on spi. Returns the handle
+ * of the panel, the same one every time for the same spi, or NULL if
+ * there are already EPD_HAL_MAX_PANELS.
+ */
+epd_hal_t* epd_hal_init(epd_hal_spi_t spi, int dc_pin, int busy_pin);
+
+/* Queue bytes to the panel, with D/C at the given level. Up to
+ * four bytes are copied; longer data must stay valid until
+ * epd_hal_flush. Returns the number of transactions queued.
+ */
+int epd_hal_write(epd_hal_t* hal, const uint8_t* data, int len, int dc);
+
+/* Queue rows of a buffer with the given stride as data. Returns the
+ * number of transactions queued.
+ */
+int epd_hal_write_rows(epd_hal_t* hal, const uint8_t* src, int stride,
+                       int row_bytes, int rows);
+
+/* Queue the same data byte a number of times. Returns the number of
+ * transactions queued.
+ */
+int epd_hal_write_fill(epd_hal_t* hal, uint8_t value, int len);
+
+/* Wait for all transfers queued to the panel to complete. */
+void epd_hal_flush(epd_hal_t* hal);
+
+/* Wait until at most the last pending transactions queued are still
+ * in flight, so that the buffers of all earlier ones can be reused.
+ */
+void epd_hal_sync(epd_hal_t* hal, int pending);
+
+/* Level of the BUSY line. */
+int epd_hal_busy(epd_hal_t* hal);
+
+/* Block until BUSY is deasserted. Returns ESP_ERR_TIMEOUT if it is
+ * still asserted after timeout_ms.
+ */
+esp_err_t epd_hal_wait_busy(epd_hal_t* hal, int timeout_ms);
+
+void epd_hal_delay_ms(int ms);
+
+/* Microseconds since boot. */
+int64_t epd_hal_time_us(void);
+
+#endif
@@ -0,0 +1,284 @@
+/* ESP32 implementation of the e-ink hardware access, on the SPI master
+ * and GPIO drivers.
+ */
+#include "epd_hal.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#include "e-ink.h"
+
+/* Transactions are queued to the SPI driver and run back to back by
+ * DMA. The transaction structs must stay valid until the driver hands
+ * them back, so they live in a ring the size of the device queue.
+ * Each slot has a small staging buffer, used to pack short row spans
+ * into one transaction.
+ */
+#define EPD_QUEUE_SIZE 7
+#define EPD_STAGE_SIZE 128
+
+/* Constant colors are sent from this buffer, repeated as needed */
+#define EPD_PATTERN_SIZE 256
+
+struct epd_hal {
+  spi_device_handle_t spi;     /* NULL if the slot is free */
+  int dc_pin;
+  int busy_pin;
+
+  spi_transaction_t trans[EPD_QUEUE_SIZE];
+  WORD_ALIGNED_ATTR uint8_t stage[EPD_QUEUE_SIZE][EPD_STAGE_SIZE];
+  int trans_next;
+  int trans_pending;
+
+  WORD_ALIGNED_ATTR uint8_t pattern[EPD_PATTERN_SIZE];
+  int pattern_color;
+
+  /* Given by the BUSY interrupt when the panel becomes ready */
+  SemaphoreHandle_t busy_sem;
+};
+
+/* Each panel on the bus is a slot here. They live in DRAM, so that DMA
+ * can read the staging and pattern buffers.
+ */
+static epd_hal_t g_hals[EPD_HAL_MAX_PANELS];
+
+/* Get the next free transaction slot, waiting for the oldest queued
+ * transaction if they are all in use.
+ */
+static int epd_next_slot(epd_hal_t* hal)
+{
+  spi_transaction_t* t;
+  esp_err_t ret;
+  int slot;
+
+  if (hal->trans_pending == EPD_QUEUE_SIZE) {
+    ret = spi_device_get_trans_result(hal->spi, &t, portMAX_DELAY);
+    assert(ret == ESP_OK);
+    --hal->trans_pending;
+  }
+  slot = hal->trans_next;
+  hal->trans_next = (hal->trans_next + 1) % EPD_QUEUE_SIZE;
+  return slot;
+}
+
+/* Queue a transaction. Up to four bytes are copied into the
+ * transaction itself; longer data is sent in place, and must be
+ * DMA-capable and stay valid until epd_hal_flush.
+ */
+static void epd_queue(epd_hal_t* hal, int slot, const uint8_t* data, int len,
+                      int dc)
+{
+  spi_transaction_t* t = &hal->trans[slot];
+  esp_err_t ret;
+
+  memset(t, 0, sizeof(*t));
+  t->length = len*8;                // Len is in bytes, transaction
+                                    // length is in bits.
+  t->user = (void*)(hal->dc_pin << 1 | dc); // D/C pin and level, set
+                                            // by pre_cb
+  if (len <= 4) {
+    t->flags = SPI_TRANS_USE_TXDATA;
+    memcpy(t->tx_data, data, len);
+  } else {
+    t->tx_buffer = data;
+  }
+  ret = spi_device_queue_trans(hal->spi, t, portMAX_DELAY);
+  assert(ret == ESP_OK);
+  ++hal->trans_pending;
+}
+
+int epd_hal_write(epd_hal_t* hal, const uint8_t* data, int len, int dc)
+{
+  if (len == 0) return 0;           // No need to send anything
+  epd_queue(hal, epd_next_slot(hal), data, len, dc);
+  return 1;
+}
+
+/* Contiguous rows go out as one transaction, others are packed into
+ * the staging buffers.
+ */
+int epd_hal_write_rows(epd_hal_t* hal, const uint8_t* src, int stride,
+                       int row_bytes, int rows)
+{
+  int count = 0;
+
+  if (row_bytes == stride)
+    return epd_hal_write(hal, src, row_bytes * rows, 1);
+
+  while (rows > 0) {
+    int slot = epd_next_slot(hal);
+    int n = EPD_STAGE_SIZE / row_bytes;
+    if (n > rows)
+      n = rows;
+    for (int j = 0; j < n; ++j) {
+      memcpy(&hal->stage[slot][j * row_bytes], src, row_bytes);
+      src += stride;
+    }
+    epd_queue(hal, slot, hal->stage[slot], n * row_bytes, 1);
+    rows -= n;
+    ++count;
+  }
+  return count;
+}
+
+int epd_hal_write_fill(epd_hal_t* hal, uint8_t value, int len)
+{
+  int count = 0;
+
+  if (hal->pattern_color != value) {
+    /* Don't change the pattern under queued transactions */
+    epd_hal_flush(hal);
+    memset(hal->pattern, value, sizeof(hal->pattern));
+    hal->pattern_color = value;
+  }
+  while (len > 0) {
+    int n = len < EPD_PATTERN_SIZE ? len : EPD_PATTERN_SIZE;
+    epd_queue(hal, epd_next_slot(hal), hal->pattern, n, 1);
+    len -= n;
+    ++count;
+  }
+  return count;
+}
+
+void epd_hal_flush(epd_hal_t* hal)
+{
+  epd_hal_sync(hal, 0);
+}
+
+void epd_hal_sync(epd_hal_t* hal, int pending)
+{
+  spi_transaction_t* t;
+  esp_err_t ret;
+
+  while (hal->trans_pending > pending) {
+    ret = spi_device_get_trans_result(hal->spi, &t, portMAX_DELAY);
+    assert(ret == ESP_OK);
+    --hal->trans_pending;
+  }
+}
+
+int epd_hal_busy(epd_hal_t* hal)
+{
+  return gpio_get_level(hal->busy_pin);
+}
+
+/* Called when BUSY is low. The interrupt is level triggered, so that it
+ * can also wake the chip from light sleep; disable it again right away.
+ */
+static void epd_busy_isr(void* arg)
+{
+  epd_hal_t* hal = arg;
+  BaseType_t woken = pdFALSE;
+  gpio_intr_disable(hal->busy_pin);
+  xSemaphoreGiveFromISR(hal->busy_sem, &woken);
+  if (woken == pdTRUE)
+    portYIELD_FROM_ISR();
+}
+
+/* The task blocks on the BUSY interrupt, so the CPU is free to idle or
+ * light sleep meanwhile.
+ */
+esp_err_t epd_hal_wait_busy(epd_hal_t* hal, int timeout_ms)
+{
+  esp_err_t ret = ESP_OK;
+
+  if (!gpio_get_level(hal->busy_pin))
+    return ESP_OK;
+
+  xSemaphoreTake(hal->busy_sem, 0);  // Drop any stale give
+  gpio_set_intr_type(hal->busy_pin, GPIO_INTR_LOW_LEVEL);
+  gpio_wakeup_enable(hal->busy_pin, GPIO_INTR_LOW_LEVEL);
+  gpio_intr_enable(hal->busy_pin);
+  if (xSemaphoreTake(hal->busy_sem, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+    gpio_intr_disable(hal->busy_pin);
+    ret = ESP_ERR_TIMEOUT;
+  }
+  gpio_wakeup_disable(hal->busy_pin);
+  return ret;
+}
+
+void epd_hal_delay_ms(int ms)
+{
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+int64_t epd_hal_time_us(void)
+{
+  return esp_timer_get_time();
+}
+
+epd_hal_t* epd_hal_init(epd_hal_spi_t spi, int dc_pin, int busy_pin)
+{
+  static int isr_installed;
+  epd_hal_t* hal = NULL;
+
+  for (int i = 0; i < EPD_HAL_MAX_PANELS; ++i) {
+    if (g_hals[i].spi == spi)
+      return &g_hals[i];
+    if (hal == NULL && g_hals[i].spi == NULL)
+      hal = &g_hals[i];
+  }
+  if (hal == NULL)
+    return NULL;
+
+  hal->spi = spi;
+  hal->dc_pin = dc_pin;
+  hal->busy_pin = busy_pin;
+  hal->pattern_color = -1;
+
+  // Initialize non-SPI GPIOs
+  gpio_set_direction(dc_pin, GPIO_MODE_OUTPUT);
+  gpio_set_direction(busy_pin, GPIO_MODE_INPUT);
+
+  // BUSY interrupt, also used to wake from light sleep while waiting
+  if (!isr_installed) {
+    gpio_install_isr_service(0);     // May already be installed
+    esp_sleep_enable_gpio_wakeup();
+    isr_installed = 1;
+  }
+  hal->busy_sem = xSemaphoreCreateBinary();
+  gpio_set_intr_type(busy_pin, GPIO_INTR_LOW_LEVEL);
+  gpio_intr_disable(busy_pin);
+  gpio_isr_handler_add(busy_pin, epd_busy_isr, hal);
+  return hal;
+}
+
+/**
+ *  @brief: This function is called (in irq context!) just before a
+ *          transmission starts. It will set the D/C line of the panel
+ *          to the level indicated in the user field.
+ */
+static void epd_spi_pre_transfer_callback(spi_transaction_t *t)
+{
+  int user = (int)t->user;
+  gpio_set_level(user >> 1, user & 1);
+}
+
+/**
+ *  @brief: Add the display as a device to the SPI bus.
+ */
+esp_err_t epd_spi_bus_add(spi_host_device_t host,
+                          spi_device_handle_t* handle,
+                          int cs_pin, int clock_hz) {
+  spi_device_interface_config_t devcfg =
+    {
+     .clock_speed_hz = clock_hz,              // Clock speed of the panel
+     .mode = 0,                               // SPI mode 0
+     .spics_io_num = cs_pin,                  // CS pin
+     .queue_size = EPD_QUEUE_SIZE,            // We want to be able to
+                                              // queue 7 transactions
+     .pre_cb = epd_spi_pre_transfer_callback, // Specify pre-transfer
+                                              // callback to handle D/C
+                                              // line
+    };
+
+  // Attach the display to the SPI bus
+  return spi_bus_add_device(host, &devcfg, handle);
+}
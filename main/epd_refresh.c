@@ -0,0 +1,274 @@
+#include "epd_refresh.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "e-ink.h"
+
+#define TAG "fc"
+
+#define ROW_BYTES (EPD_WIDTH / 8)
+
+/* Changed rows separated by fewer unchanged rows than this end up in
+ * the same area. Each area costs a few commands, so small gaps are
+ * cheaper to resend than to split on.
+ */
+#define MERGE_GAP 8
+
+void epd_diff_init(epd_diff_t* diff, epd_rect_t* rects, int max_rects) {
+  diff->rects = rects;
+  diff->max_rects = max_rects;
+  diff->count = 0;
+}
+
+void epd_diff_rows(epd_diff_t* diff, const uint8_t* old_rows,
+                   const uint8_t* new_rows, int y, int rows) {
+  for (int i = 0; i < rows; ++i, ++y) {
+    const uint8_t* o = old_rows + i * ROW_BYTES;
+    const uint8_t* c = new_rows + i * ROW_BYTES;
+    epd_rect_t* cur = diff->count ? &diff->rects[diff->count - 1] : NULL;
+    int l, r;
+
+    if (memcmp(o, c, ROW_BYTES) == 0)
+      continue;
+    for (l = 0; o[l] == c[l]; ++l) {}
+    for (r = ROW_BYTES - 1; o[r] == c[r]; --r) {}
+
+    if (cur != NULL && (y - (cur->y + cur->height) < MERGE_GAP
+                        || diff->count == diff->max_rects)) {
+      /* Grow the current area. Once we are out of areas, the last one
+       * takes everything that is left. */
+      int cl = cur->x / 8;
+      int cr = (cur->x + cur->width) / 8 - 1;
+      if (l < cl) cl = l;
+      if (r > cr) cr = r;
+      cur->x = cl * 8;
+      cur->width = (cr - cl + 1) * 8;
+      cur->height = y - cur->y + 1;
+    } else {
+      cur = &diff->rects[diff->count++];
+      cur->x = l * 8;
+      cur->y = y;
+      cur->width = (r - l + 1) * 8;
+      cur->height = 1;
+    }
+  }
+}
+
+/* Bands for the display are rendered, and kept as the staged frame.
+ * Resending a band later copies it back out.
+ */
+typedef struct {
+  epd_band_fn_t render;
+  void* ctx;
+  uint8_t* frame;
+} band_source_t;
+
+static void render_band(void* arg, uint8_t* band, int y, int rows) {
+  band_source_t* src = arg;
+  src->render(src->ctx, band, y, rows);
+  memcpy(src->frame + y * ROW_BYTES, band, rows * ROW_BYTES);
+}
+
+static void copy_band(void* arg, uint8_t* band, int y, int rows) {
+  const uint8_t* frame = arg;
+  memcpy(band, frame + y * ROW_BYTES, rows * ROW_BYTES);
+}
+
+static void write_rects(epd_t* epd, uint8_t* frame,
+                        const epd_rect_t* rects, int n) {
+  for (int i = 0; i < n; ++i) {
+    epd_set_frame_memory_bands(epd, rects[i].x, rects[i].y,
+                               rects[i].width, rects[i].height,
+                               copy_band, frame);
+  }
+}
+
+esp_err_t epd_refresh(epd_panel_t* panel, epd_band_fn_t render, void* ctx) {
+  esp_err_t err = epd_refresh_stage(panel, render, ctx);
+
+  if (err != ESP_OK)
+    return err;
+  return epd_refresh_show(panel);
+}
+
+esp_err_t epd_refresh_stage(epd_panel_t* panel, epd_band_fn_t render,
+                            void* ctx) {
+  epd_shown_t* shown = panel->shown;
+  epd_t* epd = &panel->epd;
+  band_source_t src = {render, ctx, panel->staged};
+
+  if (!panel->staged_valid) {
+    panel->staged_full = shown == NULL || !shown->frame_valid
+      || shown->bank_stale
+      || shown->partial_count >= CONFIG_EPD_FULL_REFRESH_INTERVAL;
+    /* The controller holds the frame on the display */
+    if (!panel->staged_full)
+      memcpy(panel->staged, shown->frame, sizeof(panel->staged));
+  }
+
+  if (!panel->staged_valid && panel->staged_full) {
+    /* Render straight to the display */
+    epd_set_lut(epd, lut_full_update);
+    epd_set_frame_memory_bands(epd, 0, 0, EPD_WIDTH, EPD_HEIGHT,
+                               render_band, &src);
+  } else {
+    uint8_t band[EPD_BAND_SIZE];
+    epd_rect_t rects[EPD_MAX_RECTS];
+    epd_diff_t diff;
+
+    /* Find what changed since the frame in the controller, a band at a
+     * time, before sending anything */
+    epd_diff_init(&diff, rects, EPD_MAX_RECTS);
+    for (int y = 0; y < EPD_HEIGHT; y += EPD_BAND_ROWS) {
+      int rows = EPD_HEIGHT - y < EPD_BAND_ROWS ? EPD_HEIGHT - y
+        : EPD_BAND_ROWS;
+      render(ctx, band, y, rows);
+      epd_diff_rows(&diff, panel->staged + y * ROW_BYTES, band, y, rows);
+      memcpy(panel->staged + y * ROW_BYTES, band, rows * ROW_BYTES);
+    }
+    if (!panel->staged_valid)
+      epd_set_lut(epd, lut_partial_update);
+    else if (diff.count != 0)
+      ESP_LOGI(TAG, "Patching %d area(s) of the staged frame", diff.count);
+    write_rects(epd, panel->staged, rects, diff.count);
+  }
+
+  panel->staged_valid = 1;
+  if (shown != NULL)
+    shown->frame_valid = 0;
+  return ESP_OK;
+}
+
+/* Start showing the staged frame. The update runs on its own; the
+ * controller is busy until it is done. */
+static void show_start(epd_panel_t* panel) {
+  epd_shown_t* shown = panel->shown;
+
+  if (!panel->staged_valid)
+    return;
+  panel->staged_valid = 0;
+
+  if (panel->staged_full) {
+    ESP_LOGI(TAG, "Full refresh");
+    if (shown != NULL)
+      shown->partial_count = 0;
+  } else {
+    epd_rect_t rects[EPD_MAX_RECTS];
+    epd_diff_t diff;
+
+    epd_diff_init(&diff, rects, EPD_MAX_RECTS);
+    epd_diff_rows(&diff, shown->frame, panel->staged, 0, EPD_HEIGHT);
+    if (diff.count == 0) {
+      ESP_LOGI(TAG, "Frame unchanged, not refreshing");
+      shown->frame_valid = 1;
+      return;
+    }
+    ESP_LOGI(TAG, "Partial refresh of %d area(s)", diff.count);
+    ++shown->partial_count;
+  }
+  epd_display_frame(&panel->epd);
+  panel->show_pending = 1;
+}
+
+/* Once the update is done, bring the other RAM bank up to date. The
+ * controller shows the difference between its two banks and then
+ * swaps them, so the changed areas go to both. The staged frame is in
+ * the first one already. */
+static void show_finish(epd_panel_t* panel) {
+  epd_shown_t* shown = panel->shown;
+  epd_t* epd = &panel->epd;
+
+  if (!panel->show_pending)
+    return;
+  panel->show_pending = 0;
+
+  if (panel->staged_full) {
+    epd_set_frame_memory_bands(epd, 0, 0, EPD_WIDTH, EPD_HEIGHT,
+                               copy_band, panel->staged);
+  } else {
+    epd_rect_t rects[EPD_MAX_RECTS];
+    epd_diff_t diff;
+
+    /* The same areas as show_start found, cheaper to find again than
+     * to keep */
+    epd_diff_init(&diff, rects, EPD_MAX_RECTS);
+    epd_diff_rows(&diff, shown->frame, panel->staged, 0, EPD_HEIGHT);
+    write_rects(epd, panel->staged, rects, diff.count);
+  }
+
+  if (shown != NULL) {
+    memcpy(shown->frame, panel->staged, sizeof(shown->frame));
+    shown->frame_valid = 1;
+  }
+}
+
+esp_err_t epd_refresh_show(epd_panel_t* panel) {
+  return epd_refresh_show_all(&panel, 1);
+}
+
+esp_err_t epd_refresh_show_all(epd_panel_t* const* panels, int n) {
+  for (int i = 0; i < n; ++i)
+    show_start(panels[i]);
+  /* The writes after each update wait for it to end, and by then the
+   * others have been running all along */
+  for (int i = 0; i < n; ++i)
+    show_finish(panels[i]);
+  return ESP_OK;
+}
+
+int epd_refresh_start(epd_panel_t* panel) {
+  epd_shown_t* shown = panel->shown;
+
+  show_start(panel);
+  if (!panel->show_pending)
+    return 0;
+  if (shown == NULL) {
+    /* Nowhere to keep the frame for later */
+    show_finish(panel);
+    return 0;
+  }
+  panel->show_pending = 0;
+
+  /* Only the whole frame can be written later, the previous one it
+   * would be diffed against is gone by then */
+  memcpy(shown->frame, panel->staged, sizeof(shown->frame));
+  shown->frame_valid = 1;
+  shown->bank_stale = 1;
+  return 1;
+}
+
+void epd_refresh_finish(epd_panel_t* panel) {
+  epd_shown_t* shown = panel->shown;
+
+  if (shown == NULL || !shown->bank_stale)
+    return;
+  epd_set_frame_memory_bands(&panel->epd, 0, 0, EPD_WIDTH, EPD_HEIGHT,
+                             copy_band, shown->frame);
+  shown->bank_stale = 0;
+}
+
+void epd_refresh_cancel(epd_panel_t* panel) {
+  epd_shown_t* shown = panel->shown;
+  epd_rect_t rects[EPD_MAX_RECTS];
+  epd_diff_t diff;
+
+  if (!panel->staged_valid)
+    return;
+  panel->staged_valid = 0;
+
+  /* The next update is a full one anyway */
+  if (panel->staged_full)
+    return;
+
+  epd_diff_init(&diff, rects, EPD_MAX_RECTS);
+  epd_diff_rows(&diff, panel->staged, shown->frame, 0, EPD_HEIGHT);
+  write_rects(&panel->epd, shown->frame, rects, diff.count);
+  shown->frame_valid = 1;
+}
+
+void epd_refresh_invalidate(epd_panel_t* panel) {
+  if (panel->shown != NULL)
+    panel->shown->frame_valid = 0;
+}
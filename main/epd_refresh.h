@@ -0,0 +1,132 @@
+#ifndef __EPD_REFRESH_H__
+#define __EPD_REFRESH_H__
+
+#include <stdint.h>
+
+#include "esp_system.h"
+
+#include "e-ink.h"
+
+/* Refresh engine on top of the e-ink driver.
+ *
+ * The frame last shown on a display is kept in RTC memory. A new frame
+ * is diffed against it, and only the changed areas are written to the
+ * controller and shown with the partial update LUT. A full update is
+ * done after a cold boot, and every CONFIG_EPD_FULL_REFRESH_INTERVAL
+ * updates to clear the ghosting that partial updates leave behind.
+ *
+ * RTC memory only has room for one frame, so only one display gets
+ * partial updates. Any other is given no shown state and always gets
+ * a full update.
+ */
+
+/* A changed area, in pixels. x and width are multiples of eight. */
+typedef struct {
+  int x;
+  int y;
+  int width;
+  int height;
+} epd_rect_t;
+
+#define EPD_MAX_RECTS 4
+
+/* Finds the areas where two frames differ, fed a few rows at a time
+ * from the top. Rows closer than a few lines are merged into one
+ * area.
+ */
+typedef struct {
+  epd_rect_t* rects;
+  int max_rects;
+  int count;     /* Areas found so far, zero if no rows differ */
+} epd_diff_t;
+
+void epd_diff_init(epd_diff_t* diff, epd_rect_t* rects, int max_rects);
+
+/* Compare the next rows, starting at frame row y. */
+void epd_diff_rows(epd_diff_t* diff, const uint8_t* old_rows,
+                   const uint8_t* new_rows, int y, int rows);
+
+/* What a display shows: the frame diffed against for partial updates,
+ * and the number of partial updates since the last full one. Outlives
+ * deep sleep only if kept in RTC memory. */
+typedef struct {
+  uint8_t frame_valid;
+  uint8_t partial_count;
+  /* Set while the second RAM bank still holds the previous frame, see
+   * epd_refresh_start */
+  uint8_t bank_stale;
+  uint8_t frame[EPD_FRAME_SIZE];
+} epd_shown_t;
+
+/* A display, and the frame staged for it. Set up epd with epd_init and
+ * point shown at where to keep what it shows, in RTC memory so that it
+ * outlives deep sleep. With shown NULL, nothing is kept and every
+ * update is a full one.
+ *
+ * Rendering goes out in bands, but the staged frame is kept whole, in
+ * DRAM, for staging ahead of the fetch (see main.c). From staging to
+ * the end of the update, two frames are needed at once:
+ *  - the one on the display, in shown, to put back in the controller
+ *    when staging is cancelled, and to find the areas to copy to the
+ *    second RAM bank once the update is done;
+ *  - the staged one, to patch when a newer frame is staged over it,
+ *    and to copy from after the update.
+ * shown can't hold both, and there is no room in RTC memory for a
+ * second frame. Rendering the staged bands again instead would need
+ * the forecast that was staged, and the icon decoded from the top
+ * again, each time. */
+typedef struct {
+  epd_t epd;
+  epd_shown_t* shown;
+  /* The frame written to the controller but not shown yet */
+  uint8_t staged_valid;
+  uint8_t staged_full; /* Shown with a full update */
+  uint8_t show_pending;
+  uint8_t staged[EPD_FRAME_SIZE];
+} epd_panel_t;
+
+/* Show a frame, using a partial update if possible. The frame is
+ * produced band by band by render, once, from the top. The display
+ * must be initialized. Nothing is sent if the frame is already shown.
+ * The same as epd_refresh_stage followed by epd_refresh_show.
+ */
+esp_err_t epd_refresh(epd_panel_t* panel, epd_band_fn_t render, void* ctx);
+
+/* Write a frame to the controller without showing it yet, so that it
+ * can be prepared while waiting for something else. Staging another
+ * frame before showing only sends the areas where the two differ.
+ * Until the staged frame is shown, the frame on the display counts as
+ * unknown, so a wake that never shows it does a full update next time.
+ */
+esp_err_t epd_refresh_stage(epd_panel_t* panel, epd_band_fn_t render,
+                            void* ctx);
+
+/* Show the staged frame, if any. */
+esp_err_t epd_refresh_show(epd_panel_t* panel);
+
+/* Show the staged frames of n panels at once. Each update is started
+ * before waiting for any, so this takes about as long as the slowest
+ * one rather than all of them. */
+esp_err_t epd_refresh_show_all(epd_panel_t* const* panels, int n);
+
+/* Start showing the staged frame, if any, and return without waiting
+ * for the update. Returns 1 if an update was started. The frame counts
+ * as shown already, but until epd_refresh_finish the second RAM bank
+ * of the controller holds the previous frame, so the caller is free to
+ * deep sleep through the update. Without shown, this waits for the
+ * update like epd_refresh_show and returns 0. */
+int epd_refresh_start(epd_panel_t* panel);
+
+/* Once the display is done with an update from epd_refresh_start, if
+ * any, write the frame to the second RAM bank. Only needs the display
+ * attached, see epd_attach, as the frame is the shown one. */
+void epd_refresh_finish(epd_panel_t* panel);
+
+/* Drop the staged frame, if any, putting back what the display shows
+ * in the controller. */
+void epd_refresh_cancel(epd_panel_t* panel);
+
+/* Forget the displayed frame, forcing a full update next time. */
+void epd_refresh_invalidate(epd_panel_t* panel);
+
+#endif
@@ -1,11 +1,13 @@
 #include "forecast.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "cJSON.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/event_groups.h"
 #include "freertos/FreeRTOS.h"
@@ -17,164 +19,344 @@
 #include "lwip/sys.h"
 #include "nvs_flash.h"
 
-#define WEB_SERVER "api.apixu.com"
+#include "dns_cache.h"
+#include "forecast_parser.h"
+#include "profile.h"
+#include "tls.h"
+#include "wall_clock.h"
+
 #define WEB_PORT CONFIG_APIXU_PORT
 #define WEB_URL CONFIG_APIXU_URL
-#define WEB_FILE_SIZE 65536
+#define WEB_HOST_MAX 64
+/* The response is parsed as it arrives, in chunks of this size */
+#define WEB_CHUNK_SIZE 256
 
 #define TAG "fc"
 
-static const uint8_t* skip_headers(const uint8_t *s) {
-  int nl = 0;
-  while (*s) {
-    if (*s == '\n') {
-      if (nl) {
-        ++s;
-        break;
-      } else {
-        nl = 1;
-      }
-    } else if (*s != '\r') {
-      nl = 0;
-    }
-    ++s;
-  }
-  return s;
-}
+/* WEB_URL, taken apart */
+typedef struct {
+  int tls;
+  int port;
+  char host[WEB_HOST_MAX];
+  const char* path;
+} web_url_t;
 
-static esp_err_t parse_forecast(const uint8_t *s, forecast_t *forecast) {
-  cJSON *root = NULL;
-  cJSON *cur, *data;
+/* A connection to the server, over TLS if tls is set. The socket is
+ * non-blocking, and waiting for it fails past the deadline, in
+ * esp_timer microseconds. */
+typedef struct {
+  int s;
+  tls_t* tls;
+  int64_t deadline;
+} web_conn_t;
 
-  root = cJSON_Parse((const char *)skip_headers(s));
-  if (!cJSON_IsObject(root)) goto err;
+static const char REQUEST[] = "GET %s HTTP/1.0\r\n"
+  "Host: %s\r\n"
+  "User-Agent: esp-idf/1.0 esp32\r\n";
 
-  cur = cJSON_GetObjectItem(root, "forecast");
-  if (!cJSON_IsObject(cur)) goto err;
+/* The request, with the conditional headers and the final empty line.
+ * The host and path come from WEB_URL. */
+#define REQUEST_MAX (sizeof(REQUEST) + sizeof(WEB_URL)                     \
+                     + FORECAST_ETAG_MAX + FORECAST_DATE_MAX               \
+                     + sizeof("If-None-Match: \r\n")                       \
+                     + sizeof("If-Modified-Since: \r\n") + sizeof("\r\n"))
 
-  cur = cJSON_GetObjectItem(cur, "forecastday");
-  if (!cJSON_IsArray(cur)) goto err;
+/* Split WEB_URL into its parts. The port is WEB_PORT, or the default
+ * of the scheme if that is empty. */
+static esp_err_t parse_url(web_url_t* url) {
+  const char* s = WEB_URL;
+  size_t len;
 
-  cur = cJSON_GetArrayItem(cur, 0);
-  if (!cJSON_IsObject(cur)) goto err;
-
-  cur = cJSON_GetObjectItem(cur, "day");
-  if (!cJSON_IsObject(cur)) goto err;
+  if (strncmp(s, "https://", 8) == 0) {
+    url->tls = 1;
+    s += 8;
+  } else if (strncmp(s, "http://", 7) == 0) {
+    url->tls = 0;
+    s += 7;
+  } else {
+    ESP_LOGE(TAG, "Unsupported URL %s", WEB_URL);
+    return ESP_FAIL;
+  }
 
-  data = cJSON_GetObjectItem(cur, "mintemp_c");
-  if (!cJSON_IsNumber(data)) goto err;
-  forecast->temp_min = (int)(data->valuedouble+0.5);
+  len = strcspn(s, ":/?");
+  if (len == 0 || len >= sizeof(url->host)) {
+    ESP_LOGE(TAG, "Bad host in URL %s", WEB_URL);
+    return ESP_FAIL;
+  }
+  memcpy(url->host, s, len);
+  url->host[len] = '\0';
 
-  data = cJSON_GetObjectItem(cur, "maxtemp_c");
-  if (!cJSON_IsNumber(data)) goto err;
-  forecast->temp_max = (int)(data->valuedouble+0.5);
+  /* Skip any port, WEB_PORT is used instead */
+  s += len;
+  s += strcspn(s, "/?");
+  url->path = *s == '/' ? s : "/";
 
-  cur = cJSON_GetObjectItem(cur, "condition");
-  if (!cJSON_IsObject(cur)) goto err;
+  url->port = atoi(WEB_PORT);
+  if (url->port <= 0)
+    url->port = url->tls ? 443 : 80;
+  return ESP_OK;
+}
 
-  data = cJSON_GetObjectItem(cur, "code");
-  if (!cJSON_IsNumber(data)) goto err;
-  forecast->code = data->valueint;
+/* Build the request into buf, which holds REQUEST_MAX bytes. Asks for
+ * a response only if it differs from last, when given. */
+static int build_request(char* buf, const web_url_t* url,
+                         const forecast_version_t* last) {
+  int len;
 
-  // TODO:
-  forecast->day = 1;
+  len = snprintf(buf, REQUEST_MAX, REQUEST, url->path, url->host);
+  if (last != NULL && last->etag[0] != '\0')
+    len += snprintf(buf+len, REQUEST_MAX-len, "If-None-Match: %s\r\n",
+                    last->etag);
+  if (last != NULL && last->last_modified[0] != '\0')
+    len += snprintf(buf+len, REQUEST_MAX-len, "If-Modified-Since: %s\r\n",
+                    last->last_modified);
+  len += snprintf(buf+len, REQUEST_MAX-len, "\r\n");
+  return len;
+}
 
-  cJSON_Delete(root);
-  return ESP_OK;
+/* Wait until s is readable, or writable, or the deadline passes.
+ * Returns 0 when it is. */
+static int sock_wait(int s, int writing, int64_t deadline) {
+  int64_t left = deadline - esp_timer_get_time();
+  struct timeval tv;
+  fd_set fds;
+  int r;
 
-err:
-  ESP_LOGE(TAG, "Unable to parse JSON");
-  if (root != NULL)
-    cJSON_Delete(root);
-  return ESP_FAIL;
+  if (left <= 0)
+    return -1;
+  tv.tv_sec = left / 1000000;
+  tv.tv_usec = left % 1000000;
+  FD_ZERO(&fds);
+  FD_SET(s, &fds);
+  r = select(s+1, writing ? NULL : &fds, writing ? &fds : NULL, NULL, &tv);
+  return r > 0 ? 0 : -1;
 }
 
-static const char *REQUEST = "GET " WEB_URL " HTTP/1.0\r\n"
-  "Host: "WEB_SERVER"\r\n"
-  "User-Agent: esp-idf/1.0 esp32\r\n"
-  "\r\n";
-
-esp_err_t get_forecast(forecast_t *forecast) {
-  esp_err_t err;
-  const struct addrinfo hints =
+/* Start connecting to the server at addr, and wait for it until the
+ * deadline. Returns the non-blocking socket, or -1. */
+static int server_connect(struct in_addr addr, int port, int64_t deadline) {
+  struct sockaddr_in sa =
     {
-     .ai_family = AF_INET,
-     .ai_socktype = SOCK_STREAM,
+     .sin_family = AF_INET,
+     .sin_port = htons(port),
+     .sin_addr = addr,
     };
-  struct addrinfo *res;
-  struct in_addr *addr;
-  int s, r, i;
-  uint8_t* recv_buf;
-
-  err = getaddrinfo(WEB_SERVER, "80", &hints, &res);
-  if(err != 0 || res == NULL) {
-    ESP_LOGE(TAG, "DNS lookup failed err=%d res=%p", err, res);
-    return ESP_FAIL;
-  }
-
-  /* Code to print the resolved IP.
-   * Note: inet_ntoa is non-reentrant, look at ipaddr_ntoa_r for "real" code */
-  addr = &((struct sockaddr_in *)res->ai_addr)->sin_addr;
-  ESP_LOGI(TAG, "DNS lookup succeeded. IP=%s", inet_ntoa(*addr));
+  socklen_t len = sizeof(int);
+  int s, err = 0;
 
-  s = socket(res->ai_family, res->ai_socktype, 0);
+  s = socket(AF_INET, SOCK_STREAM, 0);
   if(s < 0) {
     ESP_LOGE(TAG, "... Failed to allocate socket.");
-    freeaddrinfo(res);
-    return ESP_FAIL;
+    return -1;
   }
   ESP_LOGI(TAG, "... allocated socket");
 
-  if(connect(s, res->ai_addr, res->ai_addrlen) != 0) {
-    ESP_LOGE(TAG, "... socket connect failed errno=%d", errno);
-    close(s);
-    freeaddrinfo(res);
-    return ESP_FAIL;
+  if (fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    ESP_LOGE(TAG, "... failed to make the socket non-blocking");
+    goto err;
   }
 
-  ESP_LOGI(TAG, "... connected");
-  freeaddrinfo(res);
+  if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    if (errno != EINPROGRESS) {
+      err = errno;
+    } else if (sock_wait(s, 1, deadline) != 0) {
+      err = ETIMEDOUT;
+    } else if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+      err = errno;
+    }
+  }
+  if (err != 0) {
+    ESP_LOGE(TAG, "... socket connect to %s:%d failed errno=%d",
+             inet_ntoa(addr), port, err);
+    goto err;
+  }
+  return s;
 
-  if (write(s, REQUEST, strlen(REQUEST)) < 0) {
-    ESP_LOGE(TAG, "... socket send failed");
-    close(s);
-    return ESP_FAIL;
+ err:
+  close(s);
+  return -1;
+}
+
+/* After a read or write returned r, wait for the socket if that is
+ * because it would block. Returns 1 to try again, 0 on failure or past
+ * the deadline. */
+static int web_blocked(web_conn_t* conn, int r, int writing) {
+  if (conn->tls != NULL) {
+    if (r != TLS_WANT_READ && r != TLS_WANT_WRITE)
+      return 0;
+    writing = r == TLS_WANT_WRITE;
+  } else if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+    return 0;
   }
-  ESP_LOGI(TAG, "... socket send success");
+  if (sock_wait(conn->s, writing, conn->deadline) != 0) {
+    ESP_LOGE(TAG, "... timed out");
+    return 0;
+  }
+  return 1;
+}
+
+static int web_handshake(web_conn_t* conn) {
+  int r;
+
+  do {
+    r = tls_handshake(conn->tls);
+  } while (r != 0 && web_blocked(conn, r, 0));
+  return r;
+}
 
-  struct timeval receiving_timeout;
-  receiving_timeout.tv_sec = 5;
-  receiving_timeout.tv_usec = 0;
-  if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &receiving_timeout,
-                 sizeof(receiving_timeout)) < 0) {
-    ESP_LOGE(TAG, "... failed to set socket receiving timeout");
-    close(s);
+static int web_write(web_conn_t* conn, const void* buf, size_t len) {
+  size_t done = 0;
+  int r;
+
+  while (done < len) {
+    if (conn->tls != NULL)
+      r = tls_write(conn->tls, (const uint8_t*)buf + done, len - done);
+    else
+      r = write(conn->s, (const uint8_t*)buf + done, len - done);
+    if (r >= 0)
+      done += r;
+    else if (!web_blocked(conn, r, 1))
+      return -1;
+  }
+  return len;
+}
+
+/* Read whatever has arrived, up to len bytes, waiting for something
+ * if nothing has. */
+static int web_read(web_conn_t* conn, void* buf, size_t len) {
+  int r;
+
+  do {
+    if (conn->tls != NULL)
+      r = tls_read(conn->tls, buf, len);
+    else
+      r = read(conn->s, buf, len);
+  } while (r < 0 && web_blocked(conn, r, 0));
+  return r;
+}
+
+static void web_close(web_conn_t* conn) {
+  if (conn->tls != NULL)
+    tls_close(conn->tls);
+  close(conn->s);
+}
+
+static int64_t earliest(int64_t a, int64_t b) {
+  return a < b ? a : b;
+}
+
+esp_err_t get_forecast(forecast_cache_t* cache, forecast_version_t* version,
+                       const forecast_version_t* last, int64_t deadline) {
+  web_url_t url;
+  web_conn_t conn;
+  struct in_addr addr;
+  int64_t end;
+  int cached;
+  int s, r = 0, len;
+  int first = 0;
+  char request[REQUEST_MAX];
+  uint8_t chunk[WEB_CHUNK_SIZE];
+  forecast_parser_t parser;
+  forecast_parser_status_t status = FORECAST_PARSER_MORE;
+
+  /* This attempt ends after the transfer timeout, or the deadline */
+  end = earliest(esp_timer_get_time()
+                 + CONFIG_WEB_TRANSFER_TIMEOUT * 1000LL, deadline);
+
+  if (parse_url(&url) != ESP_OK)
+    return ESP_FAIL;
+  if (dns_cache_resolve(url.host, &addr, &cached, end) != ESP_OK)
     return ESP_FAIL;
+  profile_mark(PROFILE_DNS);
+
+  conn.deadline = earliest(esp_timer_get_time()
+                           + CONFIG_WEB_CONNECT_TIMEOUT * 1000LL, end);
+  s = server_connect(addr, url.port, conn.deadline);
+  if (s < 0 && cached) {
+    /* The server may have moved, look it up again */
+    ESP_LOGW(TAG, "Cached address failed, doing a fresh DNS lookup");
+    dns_cache_invalidate();
+    if (dns_cache_resolve(url.host, &addr, &cached, end) != ESP_OK)
+      return ESP_FAIL;
+    profile_mark(PROFILE_DNS);
+    s = server_connect(addr, url.port, conn.deadline);
   }
-  ESP_LOGI(TAG, "... set socket receiving timeout success");
+  if (s < 0)
+    return ESP_FAIL;
+
+  ESP_LOGI(TAG, "... connected");
 
-  /* Allocate buffer for the response */
-  recv_buf = malloc(WEB_FILE_SIZE);
-  if (recv_buf == NULL) {
-    ESP_LOGI(TAG, "Could not allocate file buffer");
-    return ESP_ERR_NO_MEM;
+  conn.s = s;
+  conn.tls = NULL;
+  if (url.tls) {
+    /* The handshake counts as connecting */
+    conn.tls = tls_start(s, url.host);
+    if (conn.tls == NULL) {
+      close(s);
+      return ESP_FAIL;
+    }
+    if (web_handshake(&conn) != 0) {
+      web_close(&conn);
+      return ESP_FAIL;
+    }
   }
+  profile_mark(PROFILE_CONNECT);
+
+  /* Sending the request and the first byte of the response */
+  conn.deadline = earliest(esp_timer_get_time()
+                           + CONFIG_WEB_FIRST_BYTE_TIMEOUT * 1000LL, end);
 
-  /* Read HTTP response */
-  i = 0;
-  while (i != WEB_FILE_SIZE-1) {
-    r = read(s, recv_buf+i, WEB_FILE_SIZE-i-1);
+  len = build_request(request, &url, last);
+  if (web_write(&conn, request, len) < 0) {
+    ESP_LOGE(TAG, "... socket send failed");
+    web_close(&conn);
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "... socket send success");
+
+  /* Read and parse the HTTP response until we have the forecast,
+   * feeding the parser whatever has arrived */
+  forecast_parser_init(&parser, cache, version);
+  while (status == FORECAST_PARSER_MORE) {
+    r = web_read(&conn, chunk, sizeof(chunk));
     if (r <= 0)
       break;
-    i += r;
+    if (!first) {
+      profile_mark(PROFILE_FIRST_BYTE);
+      conn.deadline = end;
+    }
+    first = 1;
+    status = forecast_parser_feed(&parser, chunk, r);
   }
-  recv_buf[i] = 0;
 
-  ESP_LOGI(TAG, "... done reading from socket."
-           "Last read return=%d errno=%d\r\n", r, errno);
-  close(s);
+  ESP_LOGI(TAG, "... done reading from socket. "
+           "Parser status=%d last read return=%d errno=%d",
+           status, r, errno);
+  web_close(&conn);
+  profile_mark(PROFILE_LAST_BYTE);
+
+  if (parser.date[0] != '\0')
+    wall_clock_set_http_date(parser.date);
 
-  err = parse_forecast(recv_buf, forecast);
-  free(recv_buf);
-  return err;
+  /* A response cut short would be taken for the whole one next time.
+   * The parser is only done once the JSON document or the record is
+   * complete, or past the forecast, whether the connection then ended
+   * cleanly or not. */
+  if (status == FORECAST_PARSER_ERROR || status == FORECAST_PARSER_MORE) {
+    if (status == FORECAST_PARSER_MORE)
+      ESP_LOGE(TAG, "Response cut short");
+    return ESP_FAIL;
+  }
+  if (status == FORECAST_PARSER_NOT_MODIFIED) {
+    ESP_LOGI(TAG, "Forecast not modified");
+    return FORECAST_UNCHANGED;
+  }
+  if (forecast_parser_finish(&parser) != ESP_OK)
+    return ESP_FAIL;
+  profile_mark(PROFILE_PARSED);
+  if (last != NULL && version->hash == last->hash) {
+    ESP_LOGI(TAG, "Forecast fingerprint %08x unchanged", version->hash);
+    return FORECAST_SAME;
+  }
+  return ESP_OK;
 }
@@ -1,8 +1,20 @@
 #ifndef __WEATHER_H__
 #define __WEATHER_H__
 
+#include <stdint.h>
+
 #include "esp_system.h"
 
+/* Room for the ETag and Last-Modified values of the response */
+#define FORECAST_ETAG_MAX 48
+#define FORECAST_DATE_MAX 32
+
+/* Returned by get_forecast when the forecast is the one fetched last
+ * time. Not an error. FORECAST_SAME is when the server sent it whole
+ * again, with validators and a valid until time that may be new. */
+#define FORECAST_UNCHANGED 0x6001
+#define FORECAST_SAME 0x6002
+
 typedef struct {
   int day;
   int code;
@@ -10,6 +22,48 @@ typedef struct {
   int temp_max;
 } forecast_t;
 
-esp_err_t get_forecast(forecast_t* forecast);
+/* Days and hours kept from the response */
+#define FORECAST_CACHE_DAYS 3
+#define FORECAST_CACHE_HOURS (FORECAST_CACHE_DAYS * 24)
+
+/* Bits per day and per hour in the cache, see forecast_cache.c */
+#define FORECAST_DAY_BITS 34
+#define FORECAST_HOUR_BITS 18
+
+/* Every day and hour of a response, bit-packed to fit in RTC memory.
+ * Read and written through forecast_cache.h. */
+typedef struct {
+  int32_t first_day; /* Date of the first day, in days since 1970 */
+  uint32_t valid_until; /* No newer forecast before this time, 0 if not
+                         * known */
+  uint8_t days[(FORECAST_CACHE_DAYS * FORECAST_DAY_BITS + 7) / 8];
+  uint8_t hours[(FORECAST_CACHE_HOURS * FORECAST_HOUR_BITS + 7) / 8];
+} forecast_cache_t;
+
+/* What identifies a response: a fingerprint of the forecast part of
+ * the body, and the validators from the headers, if the server sent
+ * any. */
+typedef struct {
+  uint32_t hash;
+  char etag[FORECAST_ETAG_MAX];
+  char last_modified[FORECAST_DATE_MAX];
+} forecast_version_t;
+
+/* Fetch the forecast, filling in cache and version. If last is not
+ * NULL, the server is only asked for something newer than it, and
+ * returns FORECAST_UNCHANGED if it has nothing newer; cache and version
+ * are then not valid. A full response whose fingerprint matches last
+ * returns FORECAST_SAME, with cache and version valid: the forecast
+ * needs no redraw, but the validators and valid_until should be kept.
+ * The fingerprint is only known once the whole forecast part of the
+ * body has been parsed; the socket is closed there whether it matches
+ * or not, so a match saves the redraw, not the download.
+ *
+ * Connecting, the first byte of the response and the whole fetch each
+ * have a timeout, see menuconfig, and the fetch fails at the latest at
+ * deadline, in esp_timer microseconds.
+ */
+esp_err_t get_forecast(forecast_cache_t* cache, forecast_version_t* version,
+                       const forecast_version_t* last, int64_t deadline);
 
 #endif
@@ -0,0 +1,148 @@
+#include "forecast_cache.h"
+
+#include <string.h>
+
+#include "wall_clock.h"
+
+#define HOUR_S 3600
+
+/* Where a field goes: in the day or the hour entries, at which bit of
+ * the entry, how wide, and the value stored as 0 */
+typedef struct {
+  uint8_t hour;
+  uint8_t offset;
+  uint8_t width;
+  int16_t base;
+} field_layout_t;
+
+/* In the order of forecast_field_t. Days add up to FORECAST_DAY_BITS,
+ * hours to FORECAST_HOUR_BITS. */
+static const field_layout_t g_layout[FORECAST_FIELD_COUNT] =
+  {
+   { 0, 0, 1, 0 },      /* FORECAST_DAY_VALID */
+   { 0, 1, 9, 1000 },   /* FORECAST_DAY_CODE */
+   { 0, 10, 7, -64 },   /* FORECAST_DAY_MIN */
+   { 0, 17, 7, -64 },   /* FORECAST_DAY_MAX */
+   { 0, 24, 5, 0 },     /* FORECAST_DAY_SUNRISE */
+   { 0, 29, 5, 0 },     /* FORECAST_DAY_SUNSET */
+   { 1, 0, 1, 0 },      /* FORECAST_HOUR_VALID */
+   { 1, 1, 9, 1000 },   /* FORECAST_HOUR_CODE */
+   { 1, 10, 7, -64 },   /* FORECAST_HOUR_TEMP */
+   { 1, 17, 1, 0 },     /* FORECAST_HOUR_IS_DAY */
+  };
+
+static void bits_put(uint8_t* bits, int pos, int width, uint32_t value) {
+  for (int i = 0; i < width; ++i, ++pos) {
+    if (value & (1u << i))
+      bits[pos / 8] |= 1 << (pos % 8);
+    else
+      bits[pos / 8] &= ~(1 << (pos % 8));
+  }
+}
+
+static uint32_t bits_get(const uint8_t* bits, int pos, int width) {
+  uint32_t value = 0;
+
+  for (int i = 0; i < width; ++i, ++pos) {
+    if (bits[pos / 8] & (1 << (pos % 8)))
+      value |= 1u << i;
+  }
+  return value;
+}
+
+void forecast_cache_clear(forecast_cache_t* cache) {
+  memset(cache, 0, sizeof(*cache));
+}
+
+void forecast_cache_put(forecast_cache_t* cache, forecast_field_t field,
+                        int index, int value) {
+  const field_layout_t* l = &g_layout[field];
+  int max = (1 << l->width) - 1;
+
+  value -= l->base;
+  value = value < 0 ? 0 : value > max ? max : value;
+  if (l->hour) {
+    if (index >= 0 && index < FORECAST_CACHE_HOURS)
+      bits_put(cache->hours, index * FORECAST_HOUR_BITS + l->offset,
+               l->width, value);
+  } else {
+    if (index >= 0 && index < FORECAST_CACHE_DAYS)
+      bits_put(cache->days, index * FORECAST_DAY_BITS + l->offset,
+               l->width, value);
+  }
+}
+
+int forecast_cache_get(const forecast_cache_t* cache, forecast_field_t field,
+                       int index) {
+  const field_layout_t* l = &g_layout[field];
+
+  if (l->hour) {
+    if (index < 0 || index >= FORECAST_CACHE_HOURS)
+      return 0;
+    return bits_get(cache->hours, index * FORECAST_HOUR_BITS + l->offset,
+                    l->width) + l->base;
+  }
+  if (index < 0 || index >= FORECAST_CACHE_DAYS)
+    return 0;
+  return bits_get(cache->days, index * FORECAST_DAY_BITS + l->offset,
+                  l->width) + l->base;
+}
+
+/* Whether hour of the cache is between sunrise and sunset of day. Day
+ * if the clock or the sun times aren't known. */
+static int is_day(const forecast_cache_t* cache, int day, int hour) {
+  int sunrise = forecast_cache_get(cache, FORECAST_DAY_SUNRISE, day);
+  int sunset = forecast_cache_get(cache, FORECAST_DAY_SUNSET, day);
+
+  if (hour < 0 || sunrise >= sunset)
+    return 1;
+  hour -= day * 24;
+  return hour >= sunrise && hour < sunset;
+}
+
+esp_err_t forecast_cache_lookup(const forecast_cache_t* cache, time_t t,
+                                forecast_t* forecast) {
+  struct tm tm;
+  int day = 0;
+  int hour = -1;
+
+  if (wall_clock_valid()) {
+    day = wall_clock_local_day(t, &tm) - cache->first_day;
+    hour = day * 24 + tm.tm_hour;
+  }
+  if (!forecast_cache_get(cache, FORECAST_DAY_VALID, day))
+    return ESP_ERR_NOT_FOUND;
+
+  forecast->temp_min = forecast_cache_get(cache, FORECAST_DAY_MIN, day);
+  forecast->temp_max = forecast_cache_get(cache, FORECAST_DAY_MAX, day);
+  if (forecast_cache_get(cache, FORECAST_HOUR_VALID, hour)) {
+    forecast->code = forecast_cache_get(cache, FORECAST_HOUR_CODE, hour);
+    forecast->day = forecast_cache_get(cache, FORECAST_HOUR_IS_DAY, hour);
+  } else {
+    forecast->code = forecast_cache_get(cache, FORECAST_DAY_CODE, day);
+    forecast->day = is_day(cache, day, hour);
+  }
+  return ESP_OK;
+}
+
+uint32_t forecast_cache_next_change(const forecast_cache_t* cache, time_t t) {
+  forecast_t now, next;
+  struct tm tm;
+  time_t hour;
+
+  if (!wall_clock_valid() || forecast_cache_lookup(cache, t, &now) != ESP_OK)
+    return 0;
+
+  /* The shown forecast only changes on the hour, go through them until
+   * it does or the cache ends */
+  wall_clock_local_day(t, &tm);
+  hour = t - tm.tm_min * 60 - tm.tm_sec;
+  for (int i = 0; i <= FORECAST_CACHE_HOURS; ++i) {
+    hour += HOUR_S;
+    if (forecast_cache_lookup(cache, hour, &next) != ESP_OK
+        || next.code != now.code || next.day != now.day
+        || next.temp_min != now.temp_min || next.temp_max != now.temp_max)
+      return hour - t;
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef __FORECAST_CACHE_H__
+#define __FORECAST_CACHE_H__
+
+#include <time.h>
+
+#include "esp_system.h"
+
+#include "forecast.h"
+
+/* Forecast cache.
+ *
+ * A response carries several days, each with its hours, and all of it
+ * is kept in RTC memory. Day d starts at first_day + d, local time,
+ * and hour h of it is hour d * 24 + h of the cache. What to show at a
+ * given time is looked up from that, so wakes that only move on to the
+ * next hour or day redraw without fetching.
+ *
+ * Each field is stored in as few bits as it needs. Condition codes are
+ * 1000 to 1511 and temperatures -64 to 63, anything outside is
+ * clamped. Sunrise and sunset are the local hours, 0 to 23, rounded to
+ * the nearest one; unknown unless sunrise comes before sunset.
+ */
+
+typedef enum {
+  FORECAST_DAY_VALID, /* 1 once the day is complete */
+  FORECAST_DAY_CODE,
+  FORECAST_DAY_MIN,
+  FORECAST_DAY_MAX,
+  FORECAST_DAY_SUNRISE,
+  FORECAST_DAY_SUNSET,
+  FORECAST_HOUR_VALID,
+  FORECAST_HOUR_CODE,
+  FORECAST_HOUR_TEMP,
+  FORECAST_HOUR_IS_DAY,
+  FORECAST_FIELD_COUNT,
+} forecast_field_t;
+
+/* Empty the cache. */
+void forecast_cache_clear(forecast_cache_t* cache);
+
+/* Set or get a field of day or hour index. */
+void forecast_cache_put(forecast_cache_t* cache, forecast_field_t field,
+                        int index, int value);
+int forecast_cache_get(const forecast_cache_t* cache, forecast_field_t field,
+                       int index);
+
+/* Fill in the forecast to show at time t: the minimum and maximum of
+ * the day, and the condition and day or night of the hour if the cache
+ * has it. Otherwise the condition of the day, and day or night from
+ * its sunrise and sunset. Until the clock is set, that is the first
+ * day, by day.
+ * Returns ESP_ERR_NOT_FOUND if the cache doesn't cover t.
+ */
+esp_err_t forecast_cache_lookup(const forecast_cache_t* cache, time_t t,
+                                forecast_t* forecast);
+
+/* Returns the seconds from t until the forecast to show changes, the
+ * end of the cache counting as a change. Returns 0 if the cache
+ * doesn't cover t, or the clock isn't set.
+ */
+uint32_t forecast_cache_next_change(const forecast_cache_t* cache, time_t t);
+
+#endif
@@ -1,9 +1,9 @@
 #include "forecast_graphics.h"
 
-#include <stdlib.h>
 #include <string.h>
 
 #include "e-ink.h"
+#include "epd_refresh.h"
 #include "icons.h"
 #include "text.h"
 
@@ -32,37 +32,114 @@ const char *temp_to_text(int temp) {
   return c;
 }
 
-void draw_temperature(uint8_t* buf, int x, int y, int temp, int radj) {
-  const char *s = temp_to_text(temp);
-  draw_text(buf, EPD_WIDTH, EPD_HEIGHT, x, y, s, radj);
-}
+/* Renders the forecast band by band. The icon is decoded as the
+ * bands go down the frame, and the temperatures are drawn clipped to
+ * each band, from the same glyph variants every time.
+ */
+typedef struct {
+  int icon_id;
+  assets_reader_t icon;
+  char temp_min[16];
+  char temp_max[16];
+  uint8_t indexes[TEXT_GLYPH_COUNT]; /* Glyph variants to draw */
+  uint8_t next[TEXT_GLYPH_COUNT];    /* Glyph variants after drawing */
+} forecast_render_t;
 
-esp_err_t draw_forecast(forecast_t* forecast) {
-  uint8_t* buf = NULL;
+static esp_err_t render_init(forecast_render_t* r,
+                             const forecast_t* forecast) {
+  r->icon_id = code_to_icon_id(forecast->code, forecast->day);
+  if (icon_open(&r->icon, r->icon_id) != ESP_OK)
+    return ESP_FAIL;
+  strcpy(r->temp_min, temp_to_text(forecast->temp_min));
+  strcpy(r->temp_max, temp_to_text(forecast->temp_max));
+  text_get_glyph_state(r->indexes);
+  memcpy(r->next, r->indexes, sizeof(r->next));
+  return ESP_OK;
+}
 
-  buf = malloc(EPD_WIDTH*EPD_HEIGHT/8);
-  if (buf == NULL)
-    goto err;
+static void render_band(void* ctx, uint8_t* band, int y, int rows) {
+  forecast_render_t* r = ctx;
 
-  /* Copy the appropriate weather icon to the buffer */
-  const uint8_t* icon = get_icon(code_to_icon_id(forecast->code,
-                                                 forecast->day));
-  if (icon == NULL)
-    goto err;
-  memcpy(buf, icon, EPD_WIDTH*EPD_HEIGHT/8);
+  if (y == 0)
+    icon_open(&r->icon, r->icon_id);
+  assets_read(&r->icon, band, rows * (EPD_WIDTH / 8));
 
   /* Draw the minimum and maximum temperatures */
-  draw_temperature(buf, 0, 198, forecast->temp_min, 0);
-  draw_temperature(buf, 200, 198, forecast->temp_max, 1);
+  memcpy(r->next, r->indexes, sizeof(r->next));
+  draw_text_indexed(band, EPD_WIDTH, rows, 0, 198 - y, r->temp_min, 0,
+                    r->next);
+  draw_text_indexed(band, EPD_WIDTH, rows, 200, 198 - y, r->temp_max, 1,
+                    r->next);
+}
 
-  epd_set_frame_memory(buf);
-  epd_display_frame();
+esp_err_t render_forecast(uint8_t* buf, const forecast_t* forecast) {
+  forecast_render_t r;
 
-  free(buf);
+  if (render_init(&r, forecast) != ESP_OK)
+    return ESP_FAIL;
+  for (int y = 0; y < EPD_HEIGHT; y += EPD_BAND_ROWS) {
+    int rows = EPD_HEIGHT - y < EPD_BAND_ROWS ? EPD_HEIGHT - y
+      : EPD_BAND_ROWS;
+    render_band(&r, buf + y * (EPD_WIDTH / 8), y, rows);
+  }
+  text_set_glyph_state(r.next);
   return ESP_OK;
+}
+
+esp_err_t stage_forecast(epd_panel_t* panel, const forecast_t* forecast) {
+  forecast_render_t r;
+
+  /* The glyph variants move on only once the frame is shown */
+  if (render_init(&r, forecast) != ESP_OK)
+    return ESP_FAIL;
+  return epd_refresh_stage(panel, render_band, &r);
+}
+
+esp_err_t draw_forecast(epd_panel_t* panel, forecast_t* forecast) {
+  forecast_render_t r;
+  esp_err_t err;
+
+  if (render_init(&r, forecast) != ESP_OK)
+    return ESP_FAIL;
 
- err:
-  if (buf != NULL)
-    free(buf);
-  return ESP_FAIL;
+  /* Show it, updating only what changed if possible */
+  err = epd_refresh(panel, render_band, &r);
+  text_set_glyph_state(r.next);
+  return err;
+}
+
+esp_err_t start_forecast(epd_panel_t* panel, forecast_t* forecast) {
+  forecast_render_t r;
+  esp_err_t err;
+
+  if (render_init(&r, forecast) != ESP_OK)
+    return ESP_FAIL;
+
+  err = epd_refresh_stage(panel, render_band, &r);
+  if (err != ESP_OK)
+    return err;
+  epd_refresh_start(panel);
+  text_set_glyph_state(r.next);
+  return ESP_OK;
+}
+
+esp_err_t draw_forecasts(epd_panel_t* const* panels,
+                         const forecast_t* forecasts, int n) {
+  uint8_t indexes[TEXT_GLYPH_COUNT];
+  forecast_render_t r;
+
+  /* Each panel picks up the glyph variants where the previous one left
+   * them, so that none repeats another */
+  text_get_glyph_state(indexes);
+  for (int i = 0; i < n; ++i) {
+    if (render_init(&r, &forecasts[i]) != ESP_OK
+        || epd_refresh_stage(panels[i], render_band, &r) != ESP_OK) {
+      while (i >= 0)
+        epd_refresh_cancel(panels[i--]);
+      text_set_glyph_state(indexes);
+      return ESP_FAIL;
+    }
+    text_set_glyph_state(r.next);
+  }
+  return epd_refresh_show_all(panels, n);
 }
@@ -1,10 +1,30 @@
 #ifndef __FORECAST_GRAPHICS_H__
 #define __FORECAST_GRAPHICS_H__
 
+#include <stdint.h>
+
 #include "esp_system.h"
 
+#include "epd_refresh.h"
 #include "forecast.h"
 
-esp_err_t draw_forecast(forecast_t* forecast);
+/* Render the forecast into a full frame buffer. */
+esp_err_t render_forecast(uint8_t* buf, const forecast_t* forecast);
+
+/* Render the forecast and write it to the display without showing it,
+ * see epd_refresh_stage. */
+esp_err_t stage_forecast(epd_panel_t* panel, const forecast_t* forecast);
+
+/* Render the forecast and show it on the display. Only the areas that
+ * differ from a staged frame are sent. */
+esp_err_t draw_forecast(epd_panel_t* panel, forecast_t* forecast);
+
+/* The same, but only start the update, see epd_refresh_start. */
+esp_err_t start_forecast(epd_panel_t* panel, forecast_t* forecast);
+
+/* Show forecasts[i] on panels[i], the n updates running at the same
+ * time, see epd_refresh_show_all. */
+esp_err_t draw_forecasts(epd_panel_t* const* panels,
+                         const forecast_t* forecasts, int n);
 
 #endif
@@ -0,0 +1,383 @@
+#include "forecast_parser.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+
+#define TAG "fc"
+
+/* The fields we need, from forecast.forecastday[d].day,
+ * forecast.forecastday[d].astro and forecast.forecastday[d].hour[h] */
+#define DAYS_PATH "forecast.forecastday["
+
+/* When the provider last updated, before the forecast */
+#define UPDATED_PATH "current.last_updated_epoch"
+
+#define FIELD_TEMP_MIN (1 << 0)
+#define FIELD_TEMP_MAX (1 << 1)
+#define FIELD_CODE     (1 << 2)
+#define FIELD_ALL      (FIELD_TEMP_MIN | FIELD_TEMP_MAX | FIELD_CODE)
+
+#define HOUR_TEMP   (1 << 0)
+#define HOUR_IS_DAY (1 << 1)
+#define HOUR_CODE   (1 << 2)
+#define HOUR_ALL    (HOUR_TEMP | HOUR_IS_DAY | HOUR_CODE)
+
+/* The values that go into the hash */
+#define HASH_PATH "forecast."
+
+/* 32-bit FNV-1a */
+#define HASH_INIT  2166136261u
+#define HASH_PRIME 16777619u
+
+#if !CONFIG_FORECAST_BINARY
+/* Hash s, with its terminator so that the boundaries count */
+static uint32_t hash_string(uint32_t h, const char* s) {
+  do {
+    h = (h ^ (uint8_t)*s) * HASH_PRIME;
+  } while (*s++);
+  return h;
+}
+
+/* Parse the "[n]." after an array name, returning n and moving *path
+ * past it, or -1 */
+static int path_index(const char** path) {
+  char* end;
+  long n = strtol(*path, &end, 10);
+
+  if (end == *path || end[0] != ']' || end[1] != '.' || n < 0)
+    return -1;
+  *path = end+2;
+  return n;
+}
+
+/* To the nearest degree, halves away from zero. The cache clamps the
+ * range further, this only keeps the conversion defined. */
+static int temp_value(const char* value) {
+  double t = strtod(value, NULL);
+
+  if (!(t > INT8_MIN))
+    return INT8_MIN;
+  if (t > INT8_MAX)
+    return INT8_MAX;
+  return (int)(t < 0 ? t - 0.5 : t + 0.5);
+}
+
+/* The hour nearest to a time like "07:19 AM", or -1 */
+static int sun_hour(const char* value) {
+  char half[3];
+  int h, m;
+
+  if (sscanf(value, "%d:%d %2s", &h, &m, half) != 3
+      || h < 1 || h > 12 || m < 0 || m > 59)
+    return -1;
+  h %= 12;
+  if (strcasecmp(half, "PM") == 0)
+    h += 12;
+  else if (strcasecmp(half, "AM") != 0)
+    return -1;
+  return (h * 60 + m + 30) / 60 % 24;
+}
+
+static void on_day_string(forecast_parser_t* p, int day, const char* path,
+                          const char* value) {
+  int hour;
+
+  if (strcmp(path, "astro.sunrise") == 0) {
+    if ((hour = sun_hour(value)) >= 0)
+      forecast_cache_put(p->cache, FORECAST_DAY_SUNRISE, day, hour);
+  } else if (strcmp(path, "astro.sunset") == 0) {
+    if ((hour = sun_hour(value)) >= 0)
+      forecast_cache_put(p->cache, FORECAST_DAY_SUNSET, day, hour);
+  }
+}
+
+static void on_day_value(forecast_parser_t* p, int day, const char* path,
+                         const char* value) {
+  if (strcmp(path, "date_epoch") == 0) {
+    if (day == 0) {
+      p->cache->first_day = strtoll(value, NULL, 10) / (24*60*60);
+      p->date_found = 1;
+    }
+  } else if (strcmp(path, "day.mintemp_c") == 0) {
+    forecast_cache_put(p->cache, FORECAST_DAY_MIN, day, temp_value(value));
+    p->day_found[day] |= FIELD_TEMP_MIN;
+  } else if (strcmp(path, "day.maxtemp_c") == 0) {
+    forecast_cache_put(p->cache, FORECAST_DAY_MAX, day, temp_value(value));
+    p->day_found[day] |= FIELD_TEMP_MAX;
+  } else if (strcmp(path, "day.condition.code") == 0) {
+    forecast_cache_put(p->cache, FORECAST_DAY_CODE, day, atoi(value));
+    p->day_found[day] |= FIELD_CODE;
+  }
+}
+
+static void on_hour_value(forecast_parser_t* p, int hour, const char* path,
+                          const char* value) {
+  if (strcmp(path, "temp_c") == 0) {
+    forecast_cache_put(p->cache, FORECAST_HOUR_TEMP, hour, temp_value(value));
+    p->hour_found[hour] |= HOUR_TEMP;
+  } else if (strcmp(path, "is_day") == 0) {
+    forecast_cache_put(p->cache, FORECAST_HOUR_IS_DAY, hour, atoi(value));
+    p->hour_found[hour] |= HOUR_IS_DAY;
+  } else if (strcmp(path, "condition.code") == 0) {
+    forecast_cache_put(p->cache, FORECAST_HOUR_CODE, hour, atoi(value));
+    p->hour_found[hour] |= HOUR_CODE;
+  }
+}
+
+static int on_json_value(void* ctx, const char* path,
+                         json_type_t type, const char* value) {
+  forecast_parser_t* p = ctx;
+  int day, hour;
+
+  if (strncmp(path, HASH_PATH, sizeof(HASH_PATH)-1) != 0) {
+#if CONFIG_FORECAST_UPDATE_INTERVAL
+    /* It changes at every update, so it doesn't go into the hash */
+    if (type == JSON_TYPE_NUMBER && strcmp(path, UPDATED_PATH) == 0)
+      p->cache->valid_until = strtoul(value, NULL, 10)
+        + CONFIG_FORECAST_UPDATE_INTERVAL;
+#endif
+    /* Stop once past the forecast */
+    return p->in_forecast;
+  }
+  p->in_forecast = 1;
+  p->version->hash = hash_string(p->version->hash, path);
+  p->version->hash = hash_string(p->version->hash, value);
+
+  if ((type != JSON_TYPE_NUMBER && type != JSON_TYPE_STRING)
+      || strncmp(path, DAYS_PATH, sizeof(DAYS_PATH)-1) != 0)
+    return 0;
+  path += sizeof(DAYS_PATH)-1;
+  day = path_index(&path);
+  if (day < 0 || day >= FORECAST_CACHE_DAYS)
+    return 0;
+
+  if (type == JSON_TYPE_STRING) {
+    on_day_string(p, day, path, value);
+  } else if (strncmp(path, "hour[", 5) == 0) {
+    path += 5;
+    hour = path_index(&path);
+    if (hour >= 0 && hour < 24)
+      on_hour_value(p, day * 24 + hour, path, value);
+  } else {
+    on_day_value(p, day, path, value);
+  }
+  return 0;
+}
+
+#else
+static uint32_t get_le32(const uint8_t* b) {
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+/* Check the header of a binary record, and work out its size */
+static int wire_header(forecast_parser_t* p) {
+  const uint8_t* h = p->wire.header;
+  int days = h[FORECAST_WIRE_DAYS_OFFSET];
+  int hours = h[FORECAST_WIRE_HOURS_OFFSET];
+
+  if (memcmp(h, FORECAST_WIRE_MAGIC, 2) != 0
+      || h[FORECAST_WIRE_VERSION_OFFSET] != FORECAST_WIRE_VERSION
+      || days == 0 || (hours != 0 && hours != 24)) {
+    ESP_LOGE(TAG, "Bad forecast record, version %d",
+             h[FORECAST_WIRE_VERSION_OFFSET]);
+    return -1;
+  }
+  p->cache->first_day = (int32_t)get_le32(h + FORECAST_WIRE_FIRST_DAY_OFFSET);
+  p->cache->valid_until = get_le32(h + FORECAST_WIRE_VALID_UNTIL_OFFSET);
+  p->date_found = 1;
+  p->wire.size = FORECAST_WIRE_HEADER_SIZE + days * FORECAST_WIRE_DAY_SIZE
+    + days * hours * FORECAST_WIRE_HOUR_SIZE;
+  if (h[FORECAST_WIRE_FLAGS_OFFSET] & FORECAST_WIRE_SUN)
+    p->wire.size += days * FORECAST_WIRE_SUN_SIZE;
+  return 0;
+}
+
+/* Put entry index of a binary record, days first, then hours and sun
+ * times, in the cache */
+static void wire_entry(forecast_parser_t* p, int index) {
+  const uint8_t* e = p->wire.entry;
+  int days = p->wire.header[FORECAST_WIRE_DAYS_OFFSET];
+  int hours = days * p->wire.header[FORECAST_WIRE_HOURS_OFFSET];
+  int code = e[0] | e[1] << 8;
+
+  if (index < days) {
+    if (index >= FORECAST_CACHE_DAYS)
+      return;
+    forecast_cache_put(p->cache, FORECAST_DAY_CODE, index, code);
+    forecast_cache_put(p->cache, FORECAST_DAY_MIN, index, (int8_t)e[2]);
+    forecast_cache_put(p->cache, FORECAST_DAY_MAX, index, (int8_t)e[3]);
+    p->day_found[index] = FIELD_ALL;
+  } else if (index < days + hours) {
+    index -= days;
+    if (index >= FORECAST_CACHE_HOURS)
+      return;
+    forecast_cache_put(p->cache, FORECAST_HOUR_CODE, index, code);
+    forecast_cache_put(p->cache, FORECAST_HOUR_TEMP, index, (int8_t)e[2]);
+    forecast_cache_put(p->cache, FORECAST_HOUR_IS_DAY, index, e[3] != 0);
+    p->hour_found[index] = HOUR_ALL;
+  } else {
+    index -= days + hours;
+    if (index >= FORECAST_CACHE_DAYS || e[0] > 23 || e[1] > 23)
+      return;
+    forecast_cache_put(p->cache, FORECAST_DAY_SUNRISE, index, e[0]);
+    forecast_cache_put(p->cache, FORECAST_DAY_SUNSET, index, e[1]);
+  }
+}
+
+static forecast_parser_status_t wire_feed(forecast_parser_t* p,
+                                          const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    uint32_t off = p->wire.offset++;
+    uint8_t c = data[i];
+
+    /* Everything but the valid until time tells forecasts apart */
+    if (off < FORECAST_WIRE_VALID_UNTIL_OFFSET
+        || off >= FORECAST_WIRE_HEADER_SIZE)
+      p->version->hash = (p->version->hash ^ c) * HASH_PRIME;
+
+    if (off < FORECAST_WIRE_HEADER_SIZE) {
+      p->wire.header[off] = c;
+      if (off == FORECAST_WIRE_HEADER_SIZE-1 && wire_header(p) != 0)
+        return FORECAST_PARSER_ERROR;
+    } else {
+      off -= FORECAST_WIRE_HEADER_SIZE;
+      p->wire.entry[off % FORECAST_WIRE_DAY_SIZE] = c;
+      if (off % FORECAST_WIRE_DAY_SIZE == FORECAST_WIRE_DAY_SIZE-1)
+        wire_entry(p, off / FORECAST_WIRE_DAY_SIZE);
+    }
+    if (p->wire.offset == p->wire.size)
+      return FORECAST_PARSER_DONE;
+  }
+  return FORECAST_PARSER_MORE;
+}
+#endif
+
+/* Copy the value of the header in line to dst if its name matches,
+ * e.g. "ETag: \"abc\"". Values that don't fit are dropped. */
+static void header_value(const char* line, const char* name,
+                         char* dst, size_t size) {
+  size_t len = strlen(name);
+
+  if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+    return;
+  line += len+1;
+  while (*line == ' ' || *line == '\t')
+    ++line;
+  if (strlen(line) < size)
+    strcpy(dst, line);
+}
+
+static void header_line(forecast_parser_t* p) {
+  p->line[p->llen] = '\0';
+  if (p->status_line) {
+    /* "HTTP/1.1 200 OK" */
+    const char* sp = strchr(p->line, ' ');
+    p->status_line = 0;
+    if (strncmp(p->line, "HTTP/", 5) == 0 && sp != NULL)
+      p->status = atoi(sp+1);
+  } else if (!p->overflow) {
+    header_value(p->line, "ETag", p->version->etag,
+                 sizeof(p->version->etag));
+    header_value(p->line, "Last-Modified", p->version->last_modified,
+                 sizeof(p->version->last_modified));
+    header_value(p->line, "Date", p->date, sizeof(p->date));
+  }
+}
+
+void forecast_parser_init(forecast_parser_t* p, forecast_cache_t* cache,
+                          forecast_version_t* version) {
+  memset(p, 0, sizeof(*p));
+  memset(version, 0, sizeof(*version));
+  forecast_cache_clear(cache);
+  p->cache = cache;
+  p->version = version;
+  p->version->hash = HASH_INIT;
+  p->status_line = 1;
+#if !CONFIG_FORECAST_BINARY
+  json_extract_init(&p->json, on_json_value, p);
+#endif
+}
+
+forecast_parser_status_t forecast_parser_feed(forecast_parser_t* p,
+                                              const uint8_t* data,
+                                              size_t len) {
+  size_t i = 0;
+
+  /* Collect header lines until we see an empty one */
+  while (!p->in_body && i < len) {
+    char c = data[i++];
+    if (c == '\n') {
+      if (p->llen == 0) {
+        p->in_body = 1;
+        if (p->status == 304)
+          return FORECAST_PARSER_NOT_MODIFIED;
+        if (p->status != 200) {
+          ESP_LOGE(TAG, "HTTP status %d", p->status);
+          return FORECAST_PARSER_ERROR;
+        }
+      } else {
+        header_line(p);
+        p->llen = 0;
+        p->overflow = 0;
+      }
+    } else if (c != '\r') {
+      if (p->llen < HTTP_LINE_MAX-1)
+        p->line[p->llen++] = c;
+      else
+        p->overflow = 1;
+    }
+  }
+
+  if (i == len)
+    return FORECAST_PARSER_MORE;
+
+#if CONFIG_FORECAST_BINARY
+  return wire_feed(p, data+i, len-i);
+#else
+  switch (json_extract_feed(&p->json, (const char*)data+i, len-i)) {
+  case JSON_EXTRACT_MORE:
+    return FORECAST_PARSER_MORE;
+  case JSON_EXTRACT_DONE:
+  case JSON_EXTRACT_STOPPED:
+    return FORECAST_PARSER_DONE;
+  default:
+    ESP_LOGE(TAG, "Malformed JSON");
+    return FORECAST_PARSER_ERROR;
+  }
+#endif
+}
+
+esp_err_t forecast_parser_finish(forecast_parser_t* p) {
+  int days = 0, hours = 0;
+
+  for (int d = 0; d < FORECAST_CACHE_DAYS; ++d) {
+    if (p->day_found[d] == FIELD_ALL) {
+      forecast_cache_put(p->cache, FORECAST_DAY_VALID, d, 1);
+      ++days;
+    }
+  }
+  for (int h = 0; h < FORECAST_CACHE_HOURS; ++h) {
+    if (p->hour_found[h] == HOUR_ALL) {
+      forecast_cache_put(p->cache, FORECAST_HOUR_VALID, h, 1);
+      ++hours;
+    }
+  }
+
+#if CONFIG_FORECAST_BINARY
+  if (p->wire.size == 0 || p->wire.offset < p->wire.size) {
+    ESP_LOGE(TAG, "Forecast record cut short");
+    return ESP_FAIL;
+  }
+#endif
+  if (!p->date_found || p->day_found[0] != FIELD_ALL) {
+    ESP_LOGE(TAG, "Unable to parse JSON");
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Forecast for %d days, %d hours", days, hours);
+  return ESP_OK;
+}
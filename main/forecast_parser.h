@@ -0,0 +1,78 @@
+#ifndef __FORECAST_PARSER_H__
+#define __FORECAST_PARSER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_system.h"
+
+#include "forecast.h"
+#include "forecast_cache.h"
+#include "forecast_wire.h"
+#include "json_extract.h"
+
+/* Incremental parser for the HTTP response carrying the forecast.
+ *
+ * The response is fed in chunks as it is received. The headers are
+ * consumed line by line, and the body is run through the JSON field
+ * extractor, filling in the cache as soon as the fields are seen. The
+ * rest of the body is dropped once past the forecast. With
+ * CONFIG_FORECAST_BINARY, the body is a binary record instead, see
+ * forecast_wire.h, decoded an entry at a time.
+ *
+ * The ETag and Last-Modified headers go into the version, along with
+ * a hash of the forecast values seen until the parser stops. Those
+ * are what tells two responses apart: the rest of the body, e.g. the
+ * current conditions, changes all the time.
+ */
+
+#define HTTP_LINE_MAX 64
+
+typedef enum {
+  FORECAST_PARSER_MORE,  /* Need more input */
+  FORECAST_PARSER_DONE,  /* All fields found, the rest can be dropped */
+  FORECAST_PARSER_NOT_MODIFIED, /* 304 to a conditional request */
+  FORECAST_PARSER_ERROR, /* Bad status, headers or JSON */
+} forecast_parser_status_t;
+
+typedef struct {
+  forecast_cache_t* cache;
+  forecast_version_t* version;
+  uint8_t in_body;
+  uint8_t status_line;
+  uint8_t llen;
+  uint8_t overflow;
+  uint8_t in_forecast;
+  uint8_t date_found;
+  /* The fields seen of each day and hour */
+  uint8_t day_found[FORECAST_CACHE_DAYS];
+  uint8_t hour_found[FORECAST_CACHE_HOURS];
+  int status;
+  char date[FORECAST_DATE_MAX]; /* The Date header */
+  char line[HTTP_LINE_MAX];
+  union {
+    json_extract_t json;
+    struct {
+      uint32_t offset; /* Bytes of the record so far */
+      uint32_t size;   /* Of the whole record, once the header is in */
+      uint8_t header[FORECAST_WIRE_HEADER_SIZE];
+      uint8_t entry[FORECAST_WIRE_DAY_SIZE];
+    } wire;
+  };
+} forecast_parser_t;
+
+void forecast_parser_init(forecast_parser_t* p, forecast_cache_t* cache,
+                          forecast_version_t* version);
+
+/* Feed the next chunk of the response. */
+forecast_parser_status_t forecast_parser_feed(forecast_parser_t* p,
+                                              const uint8_t* data,
+                                              size_t len);
+
+/* Call when the response is done (or the connection closed). Marks
+ * the days and hours that are complete as valid. Returns ESP_OK if the
+ * first day is.
+ */
+esp_err_t forecast_parser_finish(forecast_parser_t* p);
+
+#endif
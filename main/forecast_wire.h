@@ -0,0 +1,69 @@
+#ifndef __FORECAST_WIRE_H__
+#define __FORECAST_WIRE_H__
+
+/* Binary forecast record, served by tools/forecast_proxy.py in place of
+ * the provider's JSON, when CONFIG_FORECAST_BINARY is set.
+ *
+ * All fields are little-endian, at fixed offsets. A 16 byte header:
+ *
+ *   0  2  magic, "FC"
+ *   2  1  format version, FORECAST_WIRE_VERSION
+ *   3  1  number of days
+ *   4  1  hours per day, 0 or 24
+ *   5  1  flags, FORECAST_WIRE_SUN if there are sun times
+ *   6  2  reserved, 0
+ *   8  4  date of the first day, in days since 1970, signed
+ *  12  4  valid until: no newer forecast before this Unix time, or 0
+ *
+ * followed by the days, each
+ *
+ *   0  2  condition code
+ *   2  1  minimum temperature, signed
+ *   3  1  maximum temperature, signed
+ *
+ * and then, if there are hours, 24 for each day, each
+ *
+ *   0  2  condition code
+ *   2  1  temperature, signed
+ *   3  1  1 if it is day, 0 if night
+ *
+ * and then, with FORECAST_WIRE_SUN, for each day
+ *
+ *   0  1  local hour of sunrise, 0 to 23
+ *   1  1  local hour of sunset, 0 to 23
+ *   2  2  reserved, 0
+ *
+ * Hour h of day d is entry d * 24 + h. All entries take four bytes.
+ * Two days without hours take 24 bytes. A record with another version
+ * is rejected; older devices skip the sun times, as they don't read
+ * past the hours.
+ */
+
+#define FORECAST_WIRE_MAGIC "FC"
+#define FORECAST_WIRE_VERSION 1
+
+#define FORECAST_WIRE_HEADER_SIZE 16
+#define FORECAST_WIRE_DAY_SIZE 4
+#define FORECAST_WIRE_HOUR_SIZE 4
+#define FORECAST_WIRE_SUN_SIZE 4
+
+/* Header fields */
+#define FORECAST_WIRE_VERSION_OFFSET 2
+#define FORECAST_WIRE_DAYS_OFFSET 3
+#define FORECAST_WIRE_HOURS_OFFSET 4
+#define FORECAST_WIRE_FLAGS_OFFSET 5
+#define FORECAST_WIRE_FIRST_DAY_OFFSET 8
+#define FORECAST_WIRE_VALID_UNTIL_OFFSET 12
+
+/* Flags */
+#define FORECAST_WIRE_SUN 0x01
+
+/* The largest record the device reads; any days past
+ * FORECAST_CACHE_DAYS are ignored */
+#define FORECAST_WIRE_MAX                                                 \
+  (FORECAST_WIRE_HEADER_SIZE                                              \
+   + FORECAST_CACHE_DAYS * (FORECAST_WIRE_DAY_SIZE                         \
+                            + 24 * FORECAST_WIRE_HOUR_SIZE                 \
+                            + FORECAST_WIRE_SUN_SIZE))
+
+#endif
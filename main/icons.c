@@ -3,33 +3,6 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-extern const uint8_t sun_raw_start[]
-  asm("_binary_sun_raw_start");
-extern const uint8_t moon_raw_start[]
-  asm("_binary_moon_raw_start");
-extern const uint8_t cloudy_raw_start[]
-  asm("_binary_cloudy_raw_start");
-extern const uint8_t mist_raw_start[]
-  asm("_binary_mist_raw_start");
-extern const uint8_t light_rain_raw_start[]
-  asm("_binary_light_rain_raw_start");
-extern const uint8_t medium_hail_raw_start[]
-  asm("_binary_medium_hail_raw_start");
-extern const uint8_t medium_rain_raw_start[]
-  asm("_binary_medium_rain_raw_start");
-extern const uint8_t medium_sleet_raw_start[]
-  asm("_binary_medium_sleet_raw_start");
-extern const uint8_t medium_snow_raw_start[]
-  asm("_binary_medium_snow_raw_start");
-extern const uint8_t heavy_rain_raw_start[]
-  asm("_binary_heavy_rain_raw_start");
-extern const uint8_t heavy_hail_raw_start[]
-  asm("_binary_heavy_hail_raw_start");
-extern const uint8_t heavy_snow_raw_start[]
-  asm("_binary_heavy_snow_raw_start");
-extern const uint8_t storm_raw_start[]
-  asm("_binary_storm_raw_start");
-
 int code_to_icon_id(int code, int day) {
   switch (code) {
   case 1000: // Sunny/clear
@@ -95,35 +68,45 @@ int code_to_icon_id(int code, int day) {
   }
 }
 
-const uint8_t* get_icon(int icon_id) {
+/* The generated asset of an icon, or -1 if there is none */
+static int icon_asset(int icon_id) {
   switch (icon_id) {
   case ICON_SUN:
-    return sun_raw_start;
+    return ASSETS_ICON_SUN;
   case ICON_MOON:
-    return moon_raw_start;
+    return ASSETS_ICON_MOON;
   case ICON_CLOUDY:
-    return cloudy_raw_start;
+    return ASSETS_ICON_CLOUDY;
   case ICON_MIST:
-    return mist_raw_start;
+    return ASSETS_ICON_MIST;
   case ICON_LIGHT_RAIN:
-    return light_rain_raw_start;
+    return ASSETS_ICON_LIGHT_RAIN;
   case ICON_MEDIUM_HAIL:
-    return medium_hail_raw_start;
+    return ASSETS_ICON_MEDIUM_HAIL;
   case ICON_MEDIUM_RAIN:
-    return medium_rain_raw_start;
+    return ASSETS_ICON_MEDIUM_RAIN;
   case ICON_MEDIUM_SLEET:
-    return medium_sleet_raw_start;
+    return ASSETS_ICON_MEDIUM_SLEET;
   case ICON_MEDIUM_SNOW:
-    return medium_snow_raw_start;
+    return ASSETS_ICON_MEDIUM_SNOW;
   case ICON_HEAVY_HAIL:
-    return heavy_hail_raw_start;
+    return ASSETS_ICON_HEAVY_HAIL;
   case ICON_HEAVY_RAIN:
-    return heavy_rain_raw_start;
+    return ASSETS_ICON_HEAVY_RAIN;
   case ICON_HEAVY_SNOW:
-    return heavy_snow_raw_start;
+    return ASSETS_ICON_HEAVY_SNOW;
   case ICON_STORM:
-    return storm_raw_start;
+    return ASSETS_ICON_STORM;
   default:
-    return NULL;
+    return -1;
   }
 }
+
+esp_err_t icon_open(assets_reader_t* reader, int icon_id) {
+  int asset = icon_asset(icon_id);
+
+  if (asset < 0)
+    return ESP_FAIL;
+  assets_icon_open(reader, asset);
+  return ESP_OK;
+}
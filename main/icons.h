@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#include "esp_system.h"
+
+#include "assets.h"
+
 #define ICON_UNKNOWN 0
 #define ICON_SUN 1
 #define ICON_MOON 2
@@ -19,6 +23,9 @@
 #define ICON_STORM 13
 
 int code_to_icon_id(int code, int day);
-const uint8_t* get_icon(int icon_id);
+/* Start decoding an icon. The frame is then read top to bottom with
+ * assets_read.
+ */
+esp_err_t icon_open(assets_reader_t* reader, int icon_id);
 
 #endif
@@ -0,0 +1,270 @@
+#include "json_extract.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+  S_VALUE,     /* Expecting a value */
+  S_OBJ_FIRST, /* After '{': a key or '}' */
+  S_OBJ_KEY,   /* After ',' in an object: a key */
+  S_COLON,     /* After a key: ':' */
+  S_ARR_FIRST, /* After '[': a value or ']' */
+  S_AFTER,     /* After a value: ',' or the end of the container */
+  S_STRING,    /* Inside a string, key or value */
+  S_LITERAL,   /* Inside a number, true, false or null */
+  S_DONE,
+  S_STOPPED,
+  S_ERROR,
+};
+
+static int is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int is_literal_char(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+    || (c >= 'A' && c <= 'Z') || c == '+' || c == '-' || c == '.';
+}
+
+/* Append to the path, truncating with a '~' if it doesn't fit. */
+static void path_append(json_extract_t* je, const char* s) {
+  while (*s) {
+    if (je->plen == JSON_EXTRACT_MAX_PATH) {
+      je->path[JSON_EXTRACT_MAX_PATH-1] = '~';
+      break;
+    }
+    je->path[je->plen++] = *s++;
+  }
+  je->path[je->plen] = '\0';
+}
+
+/* Replace the last path component with the key in the token buffer. */
+static void path_set_key(json_extract_t* je) {
+  je->plen = je->base[je->depth];
+  je->path[je->plen] = '\0';
+  if (je->plen != 0)
+    path_append(je, ".");
+  path_append(je, je->token);
+}
+
+/* Replace the last path component with the current array index. */
+static void path_set_index(json_extract_t* je) {
+  char buf[8];
+  je->plen = je->base[je->depth];
+  snprintf(buf, sizeof(buf), "[%u]", je->index[je->depth]);
+  path_append(je, buf);
+}
+
+static void token_start(json_extract_t* je, uint8_t type) {
+  je->tlen = 0;
+  je->type = type;
+}
+
+static void token_append(json_extract_t* je, char c) {
+  if (je->tlen == JSON_EXTRACT_MAX_TOKEN)
+    je->token[JSON_EXTRACT_MAX_TOKEN-1] = '~';
+  else
+    je->token[je->tlen++] = c;
+  je->token[je->tlen] = '\0';
+}
+
+static int push(json_extract_t* je, char c) {
+  if (je->depth == JSON_EXTRACT_MAX_DEPTH)
+    return 0;
+  ++je->depth;
+  je->container[je->depth] = c;
+  je->index[je->depth] = 0;
+  je->base[je->depth] = je->plen;
+  return 1;
+}
+
+/* Called after each complete value, scalar or container. */
+static void end_value(json_extract_t* je) {
+  je->state = je->depth == 0 ? S_DONE : S_AFTER;
+}
+
+static int emit(json_extract_t* je) {
+  je->token[je->tlen] = '\0';
+  if (je->type == JSON_TYPE_BOOL
+      && strcmp(je->token, "true") != 0 && strcmp(je->token, "false") != 0)
+    return -1;
+  if (je->type == JSON_TYPE_NULL && strcmp(je->token, "null") != 0)
+    return -1;
+  if (je->cb != NULL
+      && je->cb(je->ctx, je->path, (json_type_t)je->type, je->token))
+    return 1;
+  return 0;
+}
+
+static char unescape(char c) {
+  switch (c) {
+  case 'b': return '\b';
+  case 'f': return '\f';
+  case 'n': return '\n';
+  case 'r': return '\r';
+  case 't': return '\t';
+  default: return c;
+  }
+}
+
+void json_extract_init(json_extract_t* je, json_value_cb_t cb, void* ctx) {
+  memset(je, 0, sizeof(*je));
+  je->cb = cb;
+  je->ctx = ctx;
+  je->state = S_VALUE;
+}
+
+json_extract_status_t json_extract_feed(json_extract_t* je,
+                                        const char* data, size_t len) {
+  int r;
+
+  for (size_t i = 0; i < len; ++i) {
+    char c = data[i];
+  again:
+    switch (je->state) {
+    case S_VALUE:
+      if (is_space(c))
+        break;
+      if (c == '{' || c == '[') {
+        if (!push(je, c))
+          goto err;
+        je->state = c == '{' ? S_OBJ_FIRST : S_ARR_FIRST;
+      } else if (c == '"') {
+        token_start(je, JSON_TYPE_STRING);
+        je->is_key = 0;
+        je->state = S_STRING;
+      } else if (c == '-' || (c >= '0' && c <= '9')) {
+        token_start(je, JSON_TYPE_NUMBER);
+        token_append(je, c);
+        je->state = S_LITERAL;
+      } else if (c == 't' || c == 'f' || c == 'n') {
+        token_start(je, c == 'n' ? JSON_TYPE_NULL : JSON_TYPE_BOOL);
+        token_append(je, c);
+        je->state = S_LITERAL;
+      } else {
+        goto err;
+      }
+      break;
+
+    case S_OBJ_FIRST:
+      if (c == '}') {
+        --je->depth;
+        end_value(je);
+        break;
+      }
+      /* Fall through */
+    case S_OBJ_KEY:
+      if (is_space(c))
+        break;
+      if (c != '"')
+        goto err;
+      token_start(je, JSON_TYPE_STRING);
+      je->is_key = 1;
+      je->state = S_STRING;
+      break;
+
+    case S_COLON:
+      if (is_space(c))
+        break;
+      if (c != ':')
+        goto err;
+      path_set_key(je);
+      je->state = S_VALUE;
+      break;
+
+    case S_ARR_FIRST:
+      if (is_space(c))
+        break;
+      if (c == ']') {
+        --je->depth;
+        end_value(je);
+        break;
+      }
+      path_set_index(je);
+      je->state = S_VALUE;
+      goto again;
+
+    case S_AFTER:
+      if (is_space(c))
+        break;
+      if (c == ',') {
+        if (je->container[je->depth] == '{') {
+          je->state = S_OBJ_KEY;
+        } else {
+          ++je->index[je->depth];
+          path_set_index(je);
+          je->state = S_VALUE;
+        }
+      } else if ((c == '}' && je->container[je->depth] == '{')
+                 || (c == ']' && je->container[je->depth] == '[')) {
+        --je->depth;
+        end_value(je);
+      } else {
+        goto err;
+      }
+      break;
+
+    case S_STRING:
+      if (je->escape > 1) {
+        /* Skip the hex digits of a \uXXXX escape */
+        if (--je->escape == 1)
+          je->escape = 0;
+      } else if (je->escape) {
+        je->escape = 0;
+        if (c == 'u') {
+          token_append(je, '?');
+          je->escape = 5;
+        } else {
+          token_append(je, unescape(c));
+        }
+      } else if (c == '\\') {
+        je->escape = 1;
+      } else if (c == '"') {
+        je->token[je->tlen] = '\0';
+        if (je->is_key) {
+          je->state = S_COLON;
+        } else {
+          r = emit(je);
+          if (r < 0)
+            goto err;
+          if (r > 0)
+            goto stop;
+          end_value(je);
+        }
+      } else {
+        token_append(je, c);
+      }
+      break;
+
+    case S_LITERAL:
+      if (is_literal_char(c)) {
+        token_append(je, c);
+        break;
+      }
+      r = emit(je);
+      if (r < 0)
+        goto err;
+      if (r > 0)
+        goto stop;
+      end_value(je);
+      goto again;
+
+    case S_DONE:
+      return JSON_EXTRACT_DONE;
+    case S_STOPPED:
+      return JSON_EXTRACT_STOPPED;
+    default:
+      return JSON_EXTRACT_ERROR;
+    }
+  }
+
+  return je->state == S_DONE ? JSON_EXTRACT_DONE : JSON_EXTRACT_MORE;
+
+ stop:
+  je->state = S_STOPPED;
+  return JSON_EXTRACT_STOPPED;
+
+ err:
+  je->state = S_ERROR;
+  return JSON_EXTRACT_ERROR;
+}
@@ -0,0 +1,68 @@
+#ifndef __JSON_EXTRACT_H__
+#define __JSON_EXTRACT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental JSON field extractor.
+ *
+ * The document is fed in arbitrarily sized chunks, as it comes off the
+ * socket. No tree is built: for every scalar value the callback is
+ * handed the dotted path of the value, e.g.
+ *
+ *   forecast.forecastday[0].day.mintemp_c
+ *
+ * together with the value text. Strings are unescaped, numbers and
+ * literals are passed as written. Path components and values that do
+ * not fit in the fixed buffers are truncated and marked with a '~',
+ * so they never match a real key.
+ */
+
+#define JSON_EXTRACT_MAX_DEPTH 12
+#define JSON_EXTRACT_MAX_PATH  96
+#define JSON_EXTRACT_MAX_TOKEN 48
+
+typedef enum {
+  JSON_TYPE_STRING,
+  JSON_TYPE_NUMBER,
+  JSON_TYPE_BOOL,
+  JSON_TYPE_NULL,
+} json_type_t;
+
+typedef enum {
+  JSON_EXTRACT_MORE,    /* Need more input */
+  JSON_EXTRACT_DONE,    /* The top-level value is complete */
+  JSON_EXTRACT_STOPPED, /* The callback asked to stop */
+  JSON_EXTRACT_ERROR,   /* Malformed input, or nested too deep */
+} json_extract_status_t;
+
+/* Called for every scalar value. Return non-zero to stop extracting. */
+typedef int (*json_value_cb_t)(void* ctx, const char* path,
+                               json_type_t type, const char* value);
+
+typedef struct {
+  json_value_cb_t cb;
+  void* ctx;
+  uint8_t state;
+  uint8_t escape;
+  uint8_t is_key;
+  uint8_t type;
+  uint8_t depth;
+  uint8_t tlen;
+  uint8_t plen;
+  uint8_t base[JSON_EXTRACT_MAX_DEPTH+1];
+  uint8_t container[JSON_EXTRACT_MAX_DEPTH+1];
+  uint16_t index[JSON_EXTRACT_MAX_DEPTH+1];
+  char path[JSON_EXTRACT_MAX_PATH+1];
+  char token[JSON_EXTRACT_MAX_TOKEN+1];
+} json_extract_t;
+
+void json_extract_init(json_extract_t* je, json_value_cb_t cb, void* ctx);
+
+/* Feed the next chunk of the document. Input after the end of the
+ * top-level value is ignored.
+ */
+json_extract_status_t json_extract_feed(json_extract_t* je,
+                                        const char* data, size_t len);
+
+#endif
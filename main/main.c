@@ -16,12 +16,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "driver/gpio.h"
+#include "driver/rtc_io.h"
 #include "driver/spi_master.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_wpa2.h"
 #include "freertos/event_groups.h"
@@ -36,49 +42,107 @@
 #include "soc/gpio_struct.h"
 #include "tcpip_adapter.h"
 
+#include "bench.h"
 #include "e-ink.h"
+#include "epd_refresh.h"
 #include "forecast.h"
+#include "forecast_cache.h"
 #include "forecast_graphics.h"
+#include "profile.h"
+#include "rtc_state.h"
+#include "schedule.h"
+#include "text.h"
+#include "wall_clock.h"
+#include "wifi_fast.h"
 
 /* ESP32 GPIO pins for the SPI bus */
 #define PIN_NUM_MOSI 5
 #define PIN_NUM_CLK  19
 #define PIN_NUM_CS   18
 
+/* SPI clock for the EPD. Lower this if the wiring is long or noisy. */
+#define EPD_CLOCK_HZ (10*1000*1000)
+
 /* Pins for the busy and data/control signals.
- * The busy pin is currently ignored, and can be skipped. */
+ * BUSY is required: the display ignores commands while it is high, so
+ * every command after an update or reset waits for it to go low, on
+ * an interrupt that wakes the waiting task. */
 #define PIN_NUM_BUSY 21
 #define PIN_NUM_DC   4
 
-/* Sleep interval (in microseconds) between forecast updates */
-/* 900 seconds is a quarter of an hour */
-#define SLEEP_INTERVAL (900*1000*1000)
+/* Shortest deep sleep after finishing a display update, see
+ * epd_update_done */
+#define EPD_DONE_MIN_SLEEP_US (1000*1000LL)
+
+/* How long to wait for an IP when connecting to the cached AP before
+ * scanning instead */
+#define WIFI_FAST_TIMEOUT_MS 3000
+
+/* Wait between fetch attempts, doubling from the shortest to the
+ * longest */
+#define FETCH_BACKOFF_MIN_MS 500
+#define FETCH_BACKOFF_MAX_MS 4000
+
+/* The core to stage the cached forecast on, away from Wi-Fi */
+#if CONFIG_FREERTOS_UNICORE
+#define STAGE_CORE 0
+#else
+#define STAGE_CORE 1
+#endif
 
 /* FreeRTOS event group to signal when we are connected & ready to
  * make a request */
 static EventGroupHandle_t g_wifi_event_group;
 
-/* Global EPD device handle */
+/* Set when we are done with Wi-Fi, so that disconnecting is expected */
+static volatile int g_wifi_off;
+
+/* Global EPD device handle, the display with what it shows, and
+ * whether it was initialized this wake */
 static spi_device_handle_t g_epd;
+static epd_panel_t g_panel;
+static int g_epd_on;
 
-/* The event group allows multiple bits for each event,
- * but we only care about one event - are we connected
- * to the AP with an IP? */
+/* The event group allows multiple bits for each event: are we
+ * connected to the AP with an IP, and is the staging task done with
+ * the display? */
 static const int CONNECTED_BIT = BIT0;
+static const int STAGED_BIT = BIT1;
 static const char *TAG = "fc";
 
+/* Where forecast_task is in fetching the forecast */
+typedef enum {
+  FETCH_CONNECT, /* Waiting for an IP */
+  FETCH_GET,     /* Fetching */
+  FETCH_BACKOFF, /* Waiting to retry */
+  FETCH_DONE,
+} fetch_state_t;
+
 static void forecast_task(void *parm);
+static void cache_task(void *parm);
+static void stage_task(void *parm);
 
 static esp_err_t event_handler(void *ctx, system_event_t *event) {
   switch(event->event_id) {
   case SYSTEM_EVENT_STA_START:
-    xTaskCreate(forecast_task, "forecast_task", 4096,
+    profile_mark(PROFILE_WIFI_START);
+    /* The TLS handshake needs a large stack */
+    xTaskCreate(forecast_task, "forecast_task", 8192,
                 NULL, 3, NULL);
     break;
+  case SYSTEM_EVENT_STA_CONNECTED:
+    profile_mark(PROFILE_ASSOC);
+    wifi_fast_event(event);
+    break;
   case SYSTEM_EVENT_STA_GOT_IP:
+    profile_mark(PROFILE_GOT_IP);
+    wifi_fast_event(event);
     xEventGroupSetBits(g_wifi_event_group, CONNECTED_BIT);
     break;
   case SYSTEM_EVENT_STA_DISCONNECTED:
+    if (g_wifi_off)
+      break;
+    wifi_fast_fallback();
     esp_wifi_connect();
     xEventGroupClearBits(g_wifi_event_group, CONNECTED_BIT);
     break;
@@ -105,12 +169,14 @@ static void wifi_init(void) {
       .bssid_set = false,
      }
     };
+  wifi_fast_prepare(&sta_config);
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
   ESP_ERROR_CHECK(esp_wifi_start());
   ESP_ERROR_CHECK(esp_wifi_connect());
 }
 
-void app_main() {
+/* Set up the SPI bus and attach the EPD to it */
+static void epd_bus_init(void) {
   esp_err_t ret;
   spi_bus_config_t buscfg =
     {
@@ -122,20 +188,112 @@ void app_main() {
      .max_transfer_sz = 5000, /* 5000 is a full EPD frame */
     };
 
-  /* Initialize the SPI bus */
   ret = spi_bus_initialize(HSPI_HOST, &buscfg, 1);
   ESP_ERROR_CHECK(ret);
-
-  /* Attach the EPD to the SPI bus */
-  ret = epd_spi_bus_add(HSPI_HOST, &g_epd, PIN_NUM_CS);
+  ret = epd_spi_bus_add(HSPI_HOST, &g_epd, PIN_NUM_CS, EPD_CLOCK_HZ);
   ESP_ERROR_CHECK(ret);
+}
+
+/* The system time in microseconds, which keeps counting through deep
+ * sleep */
+static int64_t system_time_us(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/* The short wake after sleeping through a display update: bring the
+ * second RAM bank up to date, put the display to sleep, and sleep on
+ * until the wake that deep_sleep picked. Doesn't return. */
+static void epd_update_done(rtc_state_t* state) {
+  int64_t left;
+
+  epd_bus_init();
+  g_panel.shown = &state->epd;
+  ESP_ERROR_CHECK(epd_attach(&g_panel.epd, g_epd, PIN_NUM_DC, PIN_NUM_BUSY));
+  if (epd_wait_busy(&g_panel.epd) == ESP_OK) {
+    epd_refresh_finish(&g_panel);
+  } else {
+    /* A full update next time */
+    ESP_LOGE(TAG, "Display did not finish updating");
+    epd_refresh_invalidate(&g_panel);
+    state->epd.bank_stale = 0;
+  }
+  epd_sleep(&g_panel.epd);
+
+  left = state->epd_wake_at - system_time_us();
+  if (left < EPD_DONE_MIN_SLEEP_US)
+    left = EPD_DONE_MIN_SLEEP_US;
+  ESP_LOGI(TAG, "Display updated, sleeping %d s more", (int)(left / 1000000));
+  esp_sleep_enable_timer_wakeup(left);
+  rtc_state_save();
+  esp_deep_sleep_start();
+}
 
-  /* Initialize NVS flash */
-  ret = nvs_flash_init();
+/* Wake up when the display is done updating: on BUSY going low if it is
+ * an RTC GPIO, with a timer in case it never does, or else with a timer
+ * set to how long the update should take. */
+static void epd_update_wakeup(void) {
+  uint64_t us = epd_update_time_ms(&g_panel.epd) * 1000LL;
+
+  if (rtc_gpio_is_valid_gpio(PIN_NUM_BUSY)) {
+    esp_sleep_enable_ext0_wakeup(PIN_NUM_BUSY, 0);
+    us *= 2;
+  }
+  esp_sleep_enable_timer_wakeup(us);
+}
+
+void app_main() {
+  esp_err_t ret;
+  rtc_state_t* state;
+
+  profile_mark(PROFILE_APP_MAIN);
+
+#if CONFIG_PM_ENABLE
+  /* Let the CPU light sleep while tasks are blocked, e.g. waiting for
+   * the display to finish updating */
+  esp_pm_config_esp32_t pm_config =
+    {
+     .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+     .min_freq_mhz = 40,
+     .light_sleep_enable = true,
+    };
+  ret = esp_pm_configure(&pm_config);
   ESP_ERROR_CHECK(ret);
+#endif
+
+  /* Pick up where the previous wake left off */
+  state = rtc_state_load();
+  if (state->epd.bank_stale)
+    epd_update_done(state);
+  text_set_glyph_state(state->glyph_indexes);
+  wall_clock_init();
+#if CONFIG_WAKE_PROFILE_DUMP
+  profile_dump();
+#endif
+
+#if CONFIG_FORECAST_BENCHMARK
+  bench_run();
+#endif
 
-  /* Initialize Wifi */
-  wifi_init();
+  epd_bus_init();
+
+  if (!schedule_fetch_due() && state->cache_valid) {
+    /* Nothing to fetch, only the period to show moved on */
+    xTaskCreate(cache_task, "cache_task", 4096, NULL, 3, NULL);
+  } else {
+    /* Initialize NVS flash */
+    ret = nvs_flash_init();
+    ESP_ERROR_CHECK(ret);
+
+    /* Initialize Wifi */
+    wifi_init();
+
+    /* Get the display ready while it connects */
+    xTaskCreatePinnedToCore(stage_task, "stage_task", 4096, NULL, 3, NULL,
+                            STAGE_CORE);
+  }
 
   /* Wait forever */
   while(1) {
@@ -143,57 +301,271 @@ void app_main() {
   }
 }
 
-static void forecast_task(void *parm) {
+/* Give up on the cached AP and lease, and connect from scratch. Only
+ * disconnect: the event handler falls back and reconnects, as for any
+ * other disconnect, so that there is a single connect in flight. */
+static void wifi_reconnect_slow(void) {
+  xEventGroupClearBits(g_wifi_event_group, CONNECTED_BIT);
+  esp_wifi_disconnect();
+}
+
+/* Turn the radio off, once done with the network */
+static void wifi_off(void) {
+  g_wifi_off = 1;
+  esp_wifi_stop();
+}
+
+/* The forecast the cache has for now */
+static esp_err_t cached_forecast(forecast_t* forecast) {
+  rtc_state_t* state = rtc_state();
+
+  if (!state->cache_valid)
+    return ESP_ERR_NOT_FOUND;
+  return forecast_cache_lookup(&state->forecast_cache, time(NULL), forecast);
+}
+
+/* Whether the display shows forecast */
+static int forecast_shown(const forecast_t* forecast) {
+  rtc_state_t* state = rtc_state();
+
+  return state->forecast_valid
+    && (forecast->code == state->forecast.code)
+    && (forecast->day == state->forecast.day)
+    && (forecast->temp_min == state->forecast.temp_min)
+    && (forecast->temp_max == state->forecast.temp_max);
+}
+
+/* Initialize the display, once, only when there is something to draw */
+static void epd_on(void) {
+  if (!g_epd_on) {
+    g_panel.shown = &rtc_state()->epd;
+    epd_init(&g_panel.epd, g_epd, lut_full_update, PIN_NUM_DC, PIN_NUM_BUSY);
+  }
+  g_epd_on = 1;
+}
+
+/* Render the cached forecast and write it to the display while Wi-Fi
+ * connects. When the fetch brings nothing new, which is most of the
+ * time, only the refresh is then left to do. */
+static void stage_task(void *parm) {
+  forecast_t forecast;
+
+  if (cached_forecast(&forecast) == ESP_OK && !forecast_shown(&forecast)) {
+    epd_on();
+    if (stage_forecast(&g_panel, &forecast) == ESP_OK) {
+      profile_mark(PROFILE_STAGED);
+      ESP_LOGI(TAG, "Staged the cached forecast");
+    }
+  }
+  xEventGroupSetBits(g_wifi_event_group, STAGED_BIT);
+  vTaskDelete(NULL);
+}
+
+/* Show the cached forecast for now, unless the display already shows
+ * it, patching what was staged. Returns 1 if the display is on. */
+static int show_forecast(void) {
   forecast_t forecast;
-  forecast_t prev_forecast;
-  int first_forecast = 1;
-
-  while (1) {
-    /* Initialize the display */
-    epd_init(g_epd, lut_full_update, PIN_NUM_DC, PIN_NUM_BUSY);
-
-    /* Wait for the callback to set the CONNECTED_BIT in the
-     * event group.
-     */
-    xEventGroupWaitBits(g_wifi_event_group, CONNECTED_BIT,
-                        false, true, portMAX_DELAY);
-    ESP_LOGI(TAG, "Connected to AP, attempting to fetch forecast");
-
-    for (int retry = 0; retry < 5; ++retry) {
-      if (get_forecast(&forecast) == ESP_OK) {
-        ESP_LOGI(TAG, "Got forecast: code=%d min=%d max=%d",
-                 forecast.code, forecast.temp_min, forecast.temp_max);
-
-        if (first_forecast
-            || (forecast.code != prev_forecast.code)
-            || (forecast.temp_min != prev_forecast.temp_min)
-            || (forecast.temp_max != prev_forecast.temp_max)) {
-          first_forecast = 0;
-          prev_forecast = forecast;
-          if (draw_forecast(&forecast) == ESP_OK) {
-            ESP_LOGI(TAG, "Successfully drew forecast");
-            break;
-          }
-          else {
-            ESP_LOGE(TAG, "Unable to draw forecast");
-          }
-        }
+  rtc_state_t* state = rtc_state();
+
+  if (cached_forecast(&forecast) != ESP_OK) {
+    ESP_LOGW(TAG, "No forecast for now in the cache");
+    return g_epd_on;
+  }
+  ESP_LOGI(TAG, "Forecast for now: code=%d day=%d min=%d max=%d",
+           forecast.code, forecast.day, forecast.temp_min, forecast.temp_max);
+
+  if (forecast_shown(&forecast)) {
+    /* The display already shows this, leave it alone */
+    ESP_LOGI(TAG, "Forecast unchanged, not redrawing");
+    if (g_epd_on)
+      epd_refresh_cancel(&g_panel);
+    return g_epd_on;
+  }
+
+  epd_on();
+#if CONFIG_EPD_SLEEP_DURING_UPDATE
+  if (start_forecast(&g_panel, &forecast) != ESP_OK) {
+#else
+  if (draw_forecast(&g_panel, &forecast) != ESP_OK) {
+#endif
+    ESP_LOGE(TAG, "Unable to draw forecast");
+    state->forecast_valid = 0;
+    epd_refresh_invalidate(&g_panel);
+    return 1;
+  }
+  profile_mark(PROFILE_DRAWN);
+  ESP_LOGI(TAG, "Successfully drew forecast");
+  state->forecast = forecast;
+  state->forecast_valid = 1;
+  text_get_glyph_state(state->glyph_indexes);
+  return 1;
+}
+
+/* Let the display finish, if it is updating, and put the module in
+ * deep sleep until the next wake, which depends on how this one ended.
+ * Doesn't return. */
+static void deep_sleep(profile_end_t end, int drawn) {
+  schedule_result_t result = SCHEDULE_FAILED;
+  rtc_state_t* state = rtc_state();
+  epd_stats_t stats;
+  uint64_t sleep_us;
+
+  switch (end) {
+  case PROFILE_END_CACHED:
+    result = SCHEDULE_CACHED;
+    break;
+  case PROFILE_END_CHANGED:
+    result = SCHEDULE_CHANGED;
+    break;
+  case PROFILE_END_UNCHANGED:
+    result = SCHEDULE_UNCHANGED;
+    break;
+  default:
+    break;
+  }
+
+  /* Wait for the display to finish updating, then put it to sleep,
+   * unless we sleep through the update */
+  if (drawn) {
+    if (!state->epd.bank_stale) {
+      if (epd_wait_busy(&g_panel.epd) != ESP_OK) {
+        ESP_LOGE(TAG, "Display did not finish updating");
       }
-      else {
+      profile_mark(PROFILE_BUSY);
+      epd_sleep(&g_panel.epd);
+      profile_mark(PROFILE_EPD_SLEEP);
+    }
+    epd_get_stats(&g_panel.epd, &stats);
+    ESP_LOGI(TAG, "EPD: %u calls, %u transactions, %u bytes, "
+             "%u ms SPI, %u ms busy", stats.calls, stats.transactions,
+             stats.bytes, (uint32_t)(stats.spi_us / 1000),
+             (uint32_t)(stats.busy_us / 1000));
+  }
+
+  /* Put the module in deep sleep */
+  sleep_us = schedule_next(result);
+  if (state->epd.bank_stale) {
+    /* Wake up briefly once the display is done, see epd_update_done */
+    state->epd_wake_at = system_time_us() + sleep_us;
+    ESP_LOGI(TAG, "Going to deep sleep while the display updates");
+    epd_update_wakeup();
+  } else {
+    ESP_LOGI(TAG, "Going to deep sleep");
+    esp_sleep_enable_timer_wakeup(sleep_us);
+  }
+  profile_finish(drawn ? &stats : NULL, end);
+  rtc_state_save();
+  esp_deep_sleep_start();
+}
+
+static void cache_task(void *parm) {
+  ESP_LOGI(TAG, "No fetch due, showing the cached forecast");
+  deep_sleep(PROFILE_END_CACHED, show_forecast());
+}
+
+/* When to give up fetching, in esp_timer microseconds */
+#define FETCH_DEADLINE_US (CONFIG_FETCH_BUDGET * 1000000LL)
+
+/* Milliseconds left of the time to fetch in */
+static int fetch_time_left(void) {
+  return (FETCH_DEADLINE_US - esp_timer_get_time()) / 1000;
+}
+
+static void forecast_task(void *parm) {
+  forecast_cache_t cache;
+  forecast_version_t version;
+  rtc_state_t* state = rtc_state();
+  fetch_state_t fetch = FETCH_CONNECT;
+  profile_end_t end = PROFILE_END_NONE;
+  int backoff = FETCH_BACKOFF_MIN_MS;
+  int wait, left;
+  esp_err_t ret, fetched = ESP_FAIL;
+
+  while (fetch != FETCH_DONE) {
+    left = fetch_time_left();
+    if (left <= 0) {
+      /* Try again at the next wake */
+      ESP_LOGW(TAG, "Out of time to fetch the forecast");
+      end = fetch == FETCH_CONNECT ? PROFILE_END_NO_IP : PROFILE_END_FAILED;
+      break;
+    }
+
+    switch (fetch) {
+    case FETCH_CONNECT:
+      /* Wait for the callback to set the CONNECTED_BIT in the event
+       * group. A fast connect should be quick, scan if it isn't. */
+      wait = wifi_fast_active() && left > WIFI_FAST_TIMEOUT_MS
+        ? WIFI_FAST_TIMEOUT_MS : left;
+      if (xEventGroupWaitBits(g_wifi_event_group, CONNECTED_BIT, false,
+                              true, wait / portTICK_RATE_MS)
+          & CONNECTED_BIT) {
+        ESP_LOGI(TAG, "Connected to AP, attempting to fetch forecast");
+        fetch = FETCH_GET;
+      } else if (wifi_fast_active()) {
+        ESP_LOGW(TAG, "Fast connect timed out");
+        wifi_reconnect_slow();
+      }
+      break;
+
+    case FETCH_GET:
+      profile_attempt();
+      ret = get_forecast(&cache, &version, state->cache_valid
+                         ? &state->forecast_version : NULL,
+                         FETCH_DEADLINE_US);
+      if (ret == FORECAST_UNCHANGED) {
+        /* Same response as last time, the cache has it already */
+        end = PROFILE_END_UNCHANGED;
+        fetch = FETCH_DONE;
+      } else if (ret == FORECAST_SAME) {
+        /* Nothing to redraw, see below */
+        fetched = ret;
+        end = PROFILE_END_UNCHANGED;
+        fetch = FETCH_DONE;
+      } else if (ret == ESP_OK) {
+        fetched = ret;
+        end = PROFILE_END_CHANGED;
+        fetch = FETCH_DONE;
+      } else if (wifi_fast_active()) {
+        /* The cached lease may be stale, retry with a fresh one */
+        ESP_LOGE(TAG, "Unable to fetch forecast");
+        wifi_reconnect_slow();
+        fetch = FETCH_CONNECT;
+      } else {
         ESP_LOGE(TAG, "Unable to fetch forecast");
+        fetch = FETCH_BACKOFF;
       }
-      /* 10 second delay between attempts. */
-      vTaskDelay(10000 / portTICK_RATE_MS);
-    }
+      break;
 
-    /* Wait for the display to finish updating, then put it to sleep */
-    epd_wait_busy();
-    epd_sleep();
+    case FETCH_BACKOFF:
+      wait = backoff < left ? backoff : left;
+      ESP_LOGI(TAG, "Retrying in %d ms", wait);
+      vTaskDelay(wait / portTICK_RATE_MS);
+      backoff = backoff * 2 < FETCH_BACKOFF_MAX_MS
+        ? backoff * 2 : FETCH_BACKOFF_MAX_MS;
+      fetch = xEventGroupGetBits(g_wifi_event_group) & CONNECTED_BIT
+        ? FETCH_GET : FETCH_CONNECT;
+      break;
 
-    /* Put the module in deep sleep */
-    ESP_LOGI(TAG, "Going to deep sleep");
-    esp_sleep_enable_timer_wakeup(SLEEP_INTERVAL);
-    esp_deep_sleep_start();
-    ESP_LOGI(TAG, "Woke up from sleep");
+    case FETCH_DONE:
+      break;
+    }
+  }
+  wifi_off();
+
+  /* The staging task reads the cache, so it is only updated once that
+   * is done. Then show what the cache has for now, even if the fetch
+   * failed. */
+  xEventGroupWaitBits(g_wifi_event_group, STAGED_BIT,
+                      false, true, portMAX_DELAY);
+  if (fetched == ESP_OK) {
+    state->forecast_cache = cache;
+    state->forecast_version = version;
+    state->cache_valid = 1;
+  } else if (fetched == FORECAST_SAME) {
+    /* The server may have new validators and a new update time for
+     * the same forecast */
+    state->forecast_version = version;
+    state->forecast_cache.valid_until = cache.valid_until;
   }
+  deep_sleep(end, show_forecast());
 }
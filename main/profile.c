@@ -0,0 +1,100 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "rtc_state.h"
+
+#define TAG "fc"
+
+/* Column headings, in the order of profile_mark_t */
+static const char* const g_mark_names[PROFILE_MARK_COUNT] =
+  {
+   "main", "wifi", "stage", "assoc", "ip", "dns", "conn", "1st", "last",
+   "parse", "drawn", "busy", "epdsl", "sleep",
+  };
+
+/* The end column, in the order of profile_end_t */
+static const char* const g_end_names[PROFILE_END_COUNT] =
+  {
+   "-", "cache", "new", "same", "no-ip", "failed",
+  };
+
+/* The cycle of this wake */
+static profile_cycle_t g_cycle;
+
+static uint16_t saturate16(int64_t v) {
+  return v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : v;
+}
+
+void profile_mark(profile_mark_t mark) {
+  /* At least 1 ms, as 0 means not reached */
+  int64_t ms = esp_timer_get_time() / 1000;
+  g_cycle.mark[mark] = saturate16(ms > 0 ? ms : 1);
+}
+
+void profile_attempt(void) {
+  if (g_cycle.attempts < UINT8_MAX)
+    ++g_cycle.attempts;
+}
+
+void profile_finish(const epd_stats_t* stats, profile_end_t end) {
+  profile_ring_t* ring = &rtc_state()->profile;
+
+  profile_mark(PROFILE_SLEEP);
+  if (stats != NULL) {
+    g_cycle.spi_ms = saturate16(stats->spi_us / 1000);
+    g_cycle.busy_ms = saturate16(stats->busy_us / 1000);
+  }
+  g_cycle.heap_min_kb = saturate16(esp_get_minimum_free_heap_size() / 1024);
+  g_cycle.stack_free = saturate16(uxTaskGetStackHighWaterMark(NULL));
+  g_cycle.end = end;
+  g_cycle.wake = ring->wakes++;
+
+  ring->cycles[ring->head] = g_cycle;
+  ring->head = (ring->head + 1) % PROFILE_CYCLES;
+  if (ring->count < PROFILE_CYCLES)
+    ++ring->count;
+}
+
+void profile_dump(void) {
+  profile_ring_t* ring = &rtc_state()->profile;
+  char line[8 * (PROFILE_MARK_COUNT + 8)];
+  int len;
+
+  if (ring->count == 0)
+    return;
+
+  ESP_LOGI(TAG, "Last %d wakes, ms since boot, - if not reached:",
+           ring->count);
+  len = snprintf(line, sizeof(line), "%5s", "wake");
+  for (int m = 0; m < PROFILE_MARK_COUNT; ++m)
+    len += snprintf(line+len, sizeof(line)-len, " %5s", g_mark_names[m]);
+  snprintf(line+len, sizeof(line)-len, " %5s %5s %5s %5s %3s %-6s",
+           "spi", "busy", "heapK", "stack", "try", "end");
+  ESP_LOGI(TAG, "%s", line);
+
+  for (int i = 0; i < ring->count; ++i) {
+    const profile_cycle_t* c =
+      &ring->cycles[(ring->head + PROFILE_CYCLES - ring->count + i)
+                    % PROFILE_CYCLES];
+    len = snprintf(line, sizeof(line), "%5u", c->wake);
+    for (int m = 0; m < PROFILE_MARK_COUNT; ++m) {
+      if (c->mark[m] != 0)
+        len += snprintf(line+len, sizeof(line)-len, " %5u", c->mark[m]);
+      else
+        len += snprintf(line+len, sizeof(line)-len, " %5s", "-");
+    }
+    snprintf(line+len, sizeof(line)-len, " %5u %5u %5u %5u %3u %-6s",
+             c->spi_ms, c->busy_ms, c->heap_min_kb, c->stack_free,
+             c->attempts,
+             g_end_names[c->end < PROFILE_END_COUNT ? c->end : 0]);
+    ESP_LOGI(TAG, "%s", line);
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+#include "e-ink.h"
+
+/* Wake cycle profiler.
+ *
+ * Each phase of a wake marks the time it finished at, in ms since
+ * boot. With the EPD stats, the memory use of the wake and why it
+ * ended, that makes a cycle, and the last PROFILE_CYCLES cycles are
+ * kept in RTC memory.
+ * They are printed as a table at the start of the next wake, if
+ * CONFIG_WAKE_PROFILE_DUMP is set, or by calling profile_dump.
+ *
+ * Render and SPI push overlap, as the frame goes out band by band, so
+ * PROFILE_DRAWN marks the end of both and the SPI share comes from the
+ * EPD stats.
+ */
+
+#define PROFILE_CYCLES 8
+
+typedef enum {
+  PROFILE_APP_MAIN,   /* Boot done */
+  PROFILE_WIFI_START, /* Wifi started */
+  PROFILE_STAGED,     /* Cached forecast staged in the display, while
+                       * Wi-Fi connects */
+  PROFILE_ASSOC,      /* Associated with the AP */
+  PROFILE_GOT_IP,
+  PROFILE_DNS,        /* Server address known */
+  PROFILE_CONNECT,    /* Connected, after the TLS handshake if any */
+  PROFILE_FIRST_BYTE, /* Of the response */
+  PROFILE_LAST_BYTE,  /* Response read as far as needed */
+  PROFILE_PARSED,
+  PROFILE_DRAWN,      /* Rendered and pushed to the panel */
+  PROFILE_BUSY,       /* Panel done updating */
+  PROFILE_EPD_SLEEP,  /* Panel put to sleep */
+  PROFILE_SLEEP,      /* Going to deep sleep */
+  PROFILE_MARK_COUNT,
+} profile_mark_t;
+
+/* Why a wake ended */
+typedef enum {
+  PROFILE_END_NONE,      /* Not recorded */
+  PROFILE_END_CACHED,    /* No fetch due, redrew from the cache */
+  PROFILE_END_CHANGED,   /* Fetched a new forecast */
+  PROFILE_END_UNCHANGED, /* Fetched the same forecast as last time */
+  PROFILE_END_NO_IP,     /* Out of time connecting to Wi-Fi */
+  PROFILE_END_FAILED,    /* Out of time fetching */
+  PROFILE_END_COUNT,
+} profile_end_t;
+
+typedef struct {
+  uint16_t wake;      /* Wake number since the state was reset */
+  uint16_t mark[PROFILE_MARK_COUNT]; /* ms since boot, 0 if not reached */
+  uint16_t spi_ms;
+  uint16_t busy_ms;
+  uint16_t heap_min_kb; /* Lowest free heap */
+  uint16_t stack_free;  /* Forecast task stack never used, in bytes */
+  uint8_t attempts;   /* Fetches tried */
+  uint8_t end;        /* A profile_end_t */
+} profile_cycle_t;
+
+typedef struct {
+  uint8_t head;  /* Where the next cycle goes */
+  uint8_t count;
+  uint16_t wakes;
+  profile_cycle_t cycles[PROFILE_CYCLES];
+} profile_ring_t;
+
+/* Mark the end of a phase, now. Marking it again moves the mark, so a
+ * retried phase counts its last attempt. */
+void profile_mark(profile_mark_t mark);
+
+/* Count a fetch attempt. */
+void profile_attempt(void);
+
+/* Record the EPD stats, or NULL if the panel wasn't used, the memory
+ * use of the calling task and why the wake ended, then add the cycle
+ * to the ring. Call from the forecast task just before going to deep
+ * sleep. */
+void profile_finish(const epd_stats_t* stats, profile_end_t end);
+
+/* Print the cycles in the ring, oldest first. */
+void profile_dump(void);
+
+#endif
@@ -0,0 +1,42 @@
+#include "rtc_state.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "rom/crc.h"
+
+#define TAG "fc"
+
+static RTC_DATA_ATTR rtc_state_t g_rtc_state;
+
+static uint32_t rtc_state_crc(void) {
+  /* Everything after the CRC field */
+  return crc32_le(0, (const uint8_t*)&g_rtc_state + sizeof(uint32_t),
+                  sizeof(g_rtc_state) - sizeof(uint32_t));
+}
+
+rtc_state_t* rtc_state_load(void) {
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    ESP_LOGI(TAG, "Cold boot, resetting RTC state");
+  } else if (g_rtc_state.version != RTC_STATE_VERSION
+             || g_rtc_state.crc != rtc_state_crc()) {
+    ESP_LOGW(TAG, "RTC state invalid, resetting");
+  } else {
+    return &g_rtc_state;
+  }
+
+  memset(&g_rtc_state, 0, sizeof(g_rtc_state));
+  g_rtc_state.version = RTC_STATE_VERSION;
+  return &g_rtc_state;
+}
+
+rtc_state_t* rtc_state(void) {
+  return &g_rtc_state;
+}
+
+void rtc_state_save(void) {
+  g_rtc_state.crc = rtc_state_crc();
+}
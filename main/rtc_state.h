@@ -0,0 +1,92 @@
+#ifndef __RTC_STATE_H__
+#define __RTC_STATE_H__
+
+#include <stdint.h>
+
+#include "epd_refresh.h"
+#include "forecast.h"
+#include "profile.h"
+#include "text.h"
+
+/* State kept in RTC slow memory, which survives deep sleep.
+ *
+ * The block is guarded by a version number and a CRC. On a cold boot,
+ * or if the layout changed or the contents are corrupt, it is reset
+ * to defaults, which makes the next update a full redraw. Bump the
+ * version whenever the layout changes.
+ */
+
+#define RTC_STATE_VERSION 15
+
+/* Room for the TLS session and its ticket, see tls.c */
+#define RTC_TLS_SESSION_SIZE 192
+#define RTC_TLS_TICKET_SIZE 256
+
+typedef struct {
+  uint32_t crc;
+  uint32_t version;
+
+  /* The forecast currently shown on the display */
+  uint8_t forecast_valid;
+  forecast_t forecast;
+
+  /* The last forecast fetched, and what identifies it */
+  uint8_t cache_valid;
+  forecast_cache_t forecast_cache;
+  forecast_version_t forecast_version;
+
+  /* Glyph cycling state of the text renderer */
+  uint8_t glyph_indexes[TEXT_GLYPH_COUNT];
+
+  /* What the display shows, and the system time in microseconds of
+   * the next wake while sleeping through an update, see main.c. There
+   * is only room for one display's frame, see epd_refresh.h. */
+  epd_shown_t epd;
+  int64_t epd_wake_at;
+
+  /* Address of the forecast server, in network order or 0 if unknown,
+   * and the system time in seconds when its DNS answer expires */
+  uint32_t dns_addr;
+  int64_t dns_expires;
+
+  /* The AP we last connected to, and the last DHCP lease with the
+   * system time in seconds when we got it, see wifi_fast.h */
+  uint8_t wifi_valid;
+  uint8_t wifi_channel;
+  uint8_t wifi_bssid[6];
+  uint32_t wifi_ip;
+  uint32_t wifi_netmask;
+  uint32_t wifi_gw;
+  uint32_t wifi_dns;
+  int64_t wifi_lease_time;
+
+  /* The TLS session of the last handshake, a mbedtls_ssl_session with
+   * the ticket it points to kept separately */
+  uint8_t tls_valid;
+  uint16_t tls_ticket_len;
+  uint8_t tls_session[RTC_TLS_SESSION_SIZE];
+  uint8_t tls_ticket[RTC_TLS_TICKET_SIZE];
+
+  /* Timings of the last wakes */
+  profile_ring_t profile;
+
+  /* Whether the system time was set, see wall_clock.h, the current
+   * interval between fetches in seconds and the system time of the next
+   * fetch, see schedule.h */
+  uint8_t clock_valid;
+  uint32_t schedule_interval;
+  int64_t schedule_fetch_at;
+} rtc_state_t;
+
+/* Validate the state after boot. Returns the state, reset to defaults
+ * unless we woke from deep sleep with an intact block.
+ */
+rtc_state_t* rtc_state_load(void);
+
+/* Get the state. Only valid after rtc_state_load. */
+rtc_state_t* rtc_state(void);
+
+/* Seal the state with a fresh CRC. Call before going to deep sleep. */
+void rtc_state_save(void);
+
+#endif
@@ -0,0 +1,142 @@
+#include "schedule.h"
+
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "forecast_cache.h"
+#include "rtc_state.h"
+#include "wall_clock.h"
+
+#define TAG "fc"
+
+/* The interval to start from, after the state was reset */
+#define SCHEDULE_INITIAL_S 900
+/* Sleep at least this long, however long we were awake */
+#define SCHEDULE_MIN_SLEEP_S 10
+/* Wake this long after the shown forecast changes, so that the timer
+ * doesn't end up just before */
+#define SCHEDULE_CHANGE_SLACK_S 5
+/* Fetch this long after the provider updates, to let it settle */
+#define SCHEDULE_UPDATE_SLACK_S 30
+
+#define DAY_S (24*60*60)
+
+static uint32_t clamp_interval(uint32_t s) {
+  if (s < CONFIG_SCHEDULE_MIN_INTERVAL)
+    return CONFIG_SCHEDULE_MIN_INTERVAL;
+  if (s > CONFIG_SCHEDULE_MAX_INTERVAL)
+    return CONFIG_SCHEDULE_MAX_INTERVAL;
+  return s;
+}
+
+/* Seconds from t to the end of the quiet window, 0 if t is outside */
+static uint32_t quiet_wait(time_t t) {
+  const int start = CONFIG_SCHEDULE_QUIET_START * 3600;
+  const int end = CONFIG_SCHEDULE_QUIET_END * 3600;
+  struct tm tm;
+  int now;
+
+  if (start == end || !wall_clock_valid())
+    return 0;
+
+  localtime_r(&t, &tm);
+  now = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+  if (start < end ? now >= start && now < end : now >= start || now < end)
+    return (end - now + DAY_S) % DAY_S;
+  return 0;
+}
+
+/* The provider update nearest to t, counting every
+ * CONFIG_FORECAST_UPDATE_INTERVAL from valid, but not before valid or
+ * now. 0 if t is after valid and the updates aren't regular. */
+static uint32_t nearest_update(time_t t, time_t now, uint32_t valid) {
+  const uint32_t period = CONFIG_FORECAST_UPDATE_INTERVAL;
+  uint32_t update;
+
+  if (t <= valid)
+    return valid;
+  if (period == 0)
+    return 0;
+  update = valid + (t - valid + period / 2) / period * period;
+  if (update + SCHEDULE_UPDATE_SLACK_S < now + SCHEDULE_MIN_SLEEP_S)
+    update += period;
+  return update;
+}
+
+int schedule_fetch_due(void) {
+  return time(NULL) >= rtc_state()->schedule_fetch_at;
+}
+
+uint64_t schedule_next(schedule_result_t result) {
+  rtc_state_t* state = rtc_state();
+  uint32_t interval = state->schedule_interval;
+  uint32_t awake = esp_timer_get_time() / 1000000;
+  time_t now = time(NULL);
+  const char* why = "";
+  uint32_t sleep, quiet, change, valid, update;
+
+  if (interval == 0)
+    interval = SCHEDULE_INITIAL_S;
+  switch (result) {
+  case SCHEDULE_CHANGED:
+    interval /= 2;
+    break;
+  case SCHEDULE_UNCHANGED:
+    interval += interval / 2;
+    break;
+  case SCHEDULE_FAILED:
+    /* Keep the interval, this one doesn't say anything about it */
+    break;
+  case SCHEDULE_CACHED:
+    break;
+  }
+  interval = clamp_interval(interval);
+  state->schedule_interval = interval;
+
+  if (result == SCHEDULE_CACHED) {
+    /* No fetch this time, the next one stays when it was */
+    sleep = state->schedule_fetch_at > now + SCHEDULE_MIN_SLEEP_S
+      ? state->schedule_fetch_at - now : SCHEDULE_MIN_SLEEP_S;
+  } else {
+    sleep = result == SCHEDULE_FAILED ? CONFIG_SCHEDULE_MIN_INTERVAL
+      : interval;
+    sleep = sleep > awake + SCHEDULE_MIN_SLEEP_S
+      ? sleep - awake : SCHEDULE_MIN_SLEEP_S;
+    /* Nothing new to fetch before the server says so, and then fetch
+     * just after one of its updates */
+    valid = state->cache_valid && result != SCHEDULE_FAILED
+      && wall_clock_valid() ? state->forecast_cache.valid_until : 0;
+    update = valid != 0 ? nearest_update(now + sleep, now, valid) : 0;
+    if (update != 0) {
+      sleep = update + SCHEDULE_UPDATE_SLACK_S - now;
+      if (sleep > CONFIG_SCHEDULE_MAX_INTERVAL)
+        sleep = CONFIG_SCHEDULE_MAX_INTERVAL;
+      why = ", after the forecast is updated";
+    }
+    quiet = quiet_wait(now + sleep);
+    if (quiet != 0) {
+      sleep += quiet;
+      why = ", after the quiet window";
+    }
+    state->schedule_fetch_at = now + sleep;
+  }
+
+  /* Wake up earlier to redraw if the forecast to show changes first,
+   * but not during the quiet window either */
+  change = state->cache_valid
+    ? forecast_cache_next_change(&state->forecast_cache, now) : 0;
+  if (change != 0) {
+    change += SCHEDULE_CHANGE_SLACK_S;
+    change += quiet_wait(now + change);
+    if (change < sleep) {
+      sleep = change;
+      why = ", to redraw from the cache";
+    }
+  }
+
+  ESP_LOGI(TAG, "Next wake in %u s: interval %u s, awake %u s%s", sleep,
+           interval, awake, why);
+  return (uint64_t)sleep * 1000000;
+}
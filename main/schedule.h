@@ -0,0 +1,39 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include <stdint.h>
+
+/* Picks when to wake up next.
+ *
+ * The interval between fetches follows how often the forecast changes:
+ * it halves after a fetch that brought something new, and grows by
+ * half after one that didn't, within CONFIG_SCHEDULE_MIN_INTERVAL and
+ * CONFIG_SCHEDULE_MAX_INTERVAL. The time spent awake is taken off the
+ * sleep, so the period doesn't drift. A forecast that says when it is
+ * updated next isn't fetched again before then, and fetches are moved
+ * to just after the nearest of the provider's updates, every
+ * CONFIG_FORECAST_UPDATE_INTERVAL from then.
+ * Once the wall clock is known, fetches that would fall in the quiet
+ * window are moved to its end.
+ *
+ * In between fetches, the device also wakes whenever the forecast to
+ * show from the cache changes, e.g. at the next day, and redraws
+ * without Wi-Fi.
+ */
+
+typedef enum {
+  SCHEDULE_CHANGED,   /* Fetched a new forecast */
+  SCHEDULE_UNCHANGED, /* Fetched the same forecast as last time */
+  SCHEDULE_FAILED,    /* No forecast, try again soon */
+  SCHEDULE_CACHED,    /* Didn't fetch, only redrew from the cache */
+} schedule_result_t;
+
+/* Whether this wake should fetch the forecast. */
+int schedule_fetch_due(void);
+
+/* Returns how long to sleep after a wake that ended with result, in
+ * microseconds.
+ */
+uint64_t schedule_next(schedule_result_t result);
+
+#endif
@@ -1,17 +1,17 @@
 #include "text.h"
 
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 
-extern const uint8_t glyphs_raw_start[] asm("_binary_glyphs_raw_start");
+#include "assets.h"
 
-#define GLYPH_COUNT 13
-#define INDEX_COUNT 8
-#define GLYPH_WIDTH 64
-#define GLYPH_HEIGHT 64
-#define GLYPHS_WIDTH (GLYPH_WIDTH*GLYPH_COUNT)
-#define GLYPHS_HEIGHT (GLYPH_HEIGHT*INDEX_COUNT)
-#define GLYPHS_ROW_SIZE (GLYPHS_WIDTH*2/8)
+#define GLYPH_COUNT TEXT_GLYPH_COUNT
+#define INDEX_COUNT ASSETS_GLYPH_VARIANTS
+
+#if ASSETS_GLYPH_COUNT != TEXT_GLYPH_COUNT
+#error "main/images/glyphs.txt doesn't match TEXT_GLYPH_COUNT"
+#endif
 
 static int char_to_glyph(char c) {
   switch (c) {
@@ -33,65 +33,117 @@ static int char_to_glyph(char c) {
 }
 
 static int glyph_width(int glyph) {
-  switch (glyph) {
-  case 0: return 38;
-  case 1: return 16;
-  case 2: return 30;
-  case 3: return 28;
-  case 4: return 24;
-  case 5: return 30;
-  case 6: return 25;
-  case 7: return 25;
-  case 8: return 28;
-  case 9: return 28;
-  case 10: return 26;
-  case 11: return 32;
-  case 12: return 22;
-  default: return 0;
-  }
-}
-
-static const uint8_t* glyph_start(int glyph, int index) {
-  if (glyph < 0 || glyph >= GLYPH_COUNT || index < 0 || index >= INDEX_COUNT)
-    return NULL;
-  return glyphs_raw_start+(glyph*GLYPH_WIDTH*2/8
-                           +index*GLYPH_HEIGHT*GLYPHS_ROW_SIZE);
+  if (glyph < 0 || glyph >= GLYPH_COUNT)
+    return 0;
+  return assets_glyph_widths[glyph];
 }
 
-static void draw_glyph(uint8_t* buf, int width, int height,
-                       int x, int y, int glyph, int index,
-                       int set) {
-  const uint8_t* g;
-  int wbytes;
-  int xbytes, xshift, gx, gy;
+/* A glyph is drawn by first OR'ing its mask into the frame, then
+ * AND'ing its ink. When glyphs overlap, all of the masks go before
+ * all of the inks, so that no glyph erases its neighbour. Only the
+ * bounding box of the glyph's non-blank pixels is drawn.
+ */
 
-  g = glyph_start(glyph, index);
-  if (g == NULL)
-    return;
+/* A glyph of a string being drawn, clipped to the frame */
+typedef struct {
+  const uint8_t* g;       /* The glyph's first row in the atlas */
+  int16_t y;              /* Frame row of the glyph cell's first row */
+  int16_t bb_top;         /* Glyph row of the first atlas row */
+  int16_t top, bottom;    /* Glyph rows to draw */
+  int16_t left, right;    /* Glyph byte columns in the atlas */
+  int16_t first, last;    /* Frame bytes to write, relative to xbytes */
+  int16_t xbytes, xshift;
+} glyph_span_t;
+
+/* Enough for every glyph of a string to be in view in a 200 pixel
+ * wide frame. Longer strings are drawn in batches. */
+#define MAX_SPANS 24
+
+/* Clip the glyph to the frame. Returns 0 if nothing is in view. */
+static int clip_glyph(glyph_span_t* sp, int width, int height,
+                      int x, int y, int glyph, int index) {
+  const assets_glyph_t* bb = &assets_glyphs[glyph][index];
+  int wbytes = width / 8;
+
+  /* Far out of view, which also keeps the span fields in range */
+  if (y <= -ASSETS_GLYPH_SIZE || y >= height
+      || x <= -ASSETS_GLYPH_SIZE - 8 || x >= width)
+    return 0;
+
+  sp->g = assets_glyph_atlas + bb->offset;
+  sp->y = y;
+  sp->xbytes = x >> 3;
+  sp->xshift = x & 7;
+
+  sp->bb_top = bb->top;
+  sp->top = bb->top > -y ? bb->top : -y;
+  sp->bottom = bb->bottom < height-1-y ? bb->bottom : height-1-y;
+  sp->left = bb->left;
+  sp->right = bb->right;
+
+  /* A shifted glyph byte spills into the next frame byte */
+  sp->first = bb->left;
+  sp->last = sp->xshift ? bb->right+1 : bb->right;
+  if (sp->first < -sp->xbytes)
+    sp->first = -sp->xbytes;
+  if (sp->last > wbytes-1-sp->xbytes)
+    sp->last = wbytes-1-sp->xbytes;
+
+  return sp->top <= sp->bottom && sp->first <= sp->last;
+}
 
-  if (!set)
-    ++g;
+/* Read one plane of a glyph row into a word, leftmost pixel in the
+ * top bits. Plane 0 is the ink, inverted so that 1 is black, plane 1
+ * the mask. */
+static uint64_t glyph_row(const glyph_span_t* sp, int gy, int plane) {
+  int columns = sp->right - sp->left + 1;
+  const uint8_t* row = sp->g + 2*columns*(gy - sp->bb_top) + plane*columns;
+  uint8_t invert = plane ? 0x00 : 0xFF;
+  uint64_t bits = 0;
+
+  for (int gx = sp->left; gx <= sp->right; ++gx)
+    bits |= (uint64_t)(*row++ ^ invert) << (56 - 8*gx);
+  return bits;
+}
 
-  wbytes = width / 8;
-  xbytes = x >> 3; /* Let's hope the compiler infers an arithmetic shift */
-  xshift = x & 7;
+/* Draw a batch of glyphs, mask then ink for each row. */
+static void draw_spans(uint8_t* buf, int width,
+                       const glyph_span_t* spans, int count) {
+  int wbytes = width / 8;
+  int top = INT_MAX, bottom = INT_MIN;
+
+  for (int i = 0; i < count; ++i) {
+    if (spans[i].y + spans[i].top < top)
+      top = spans[i].y + spans[i].top;
+    if (spans[i].y + spans[i].bottom > bottom)
+      bottom = spans[i].y + spans[i].bottom;
+  }
 
-  for (gy = 0; gy < 64; ++gy) {
-    uint8_t rem = (set ? 0xFF : 0x00) << (8 - xshift);
-    if (y+gy < 0 || y+gy >= height)
-      continue;
-    for (gx = 0; gx < 9; ++gx) {
-      uint8_t gdat;
-      uint8_t data;
-      gdat = gx != 8 ? g[2*gx+GLYPHS_ROW_SIZE*gy] : set ? 0xFF : 0x00;
-      data = rem | (gdat >> xshift);
-      rem = gdat << (8 - xshift);
-      if (xbytes+gx < 0 || xbytes+gx >= wbytes)
-        continue;
-      if (set)
-        buf[xbytes+gx+wbytes*(y+gy)] &= data;
-      else
-        buf[xbytes+gx+wbytes*(y+gy)] |= data;
+  for (int fy = top; fy <= bottom; ++fy) {
+    for (int plane = 1; plane >= 0; --plane) {
+      for (int i = 0; i < count; ++i) {
+        const glyph_span_t* sp = &spans[i];
+        int gy = fy - sp->y;
+        uint8_t* dst;
+        uint64_t bits;
+        uint8_t spill;
+
+        if (gy < sp->top || gy > sp->bottom)
+          continue;
+
+        bits = glyph_row(sp, gy, plane);
+        spill = sp->xshift ? (uint8_t)(bits << (8 - sp->xshift)) : 0;
+        bits >>= sp->xshift;
+
+        dst = buf + wbytes*fy + sp->xbytes;
+        for (int b = sp->first; b <= sp->last; ++b) {
+          uint8_t data = b < 8 ? (uint8_t)(bits >> (56 - 8*b)) : spill;
+          if (plane)
+            dst[b] |= data;
+          else
+            dst[b] &= ~data;
+        }
+      }
     }
   }
 }
@@ -99,11 +151,13 @@ static void draw_glyph(uint8_t* buf, int width, int height,
 /* The next index for each glyph to be drawn. We cycle through the indexes
  * so that glyphs start repeating after eight renderings.
  */
-static int g_glyph_indexes[GLYPH_COUNT] = {0};
+static uint8_t g_glyph_indexes[GLYPH_COUNT] = {0};
 
-void draw_text(uint8_t* buf, int width, int height,
-               int x, int y, const char* s, int radj) {
-  int indexes[13];
+void draw_text_indexed(uint8_t* buf, int width, int height,
+                       int x, int y, const char* s, int radj,
+                       uint8_t* indexes) {
+  glyph_span_t spans[MAX_SPANS];
+  int count = 0;
 
   /* The glyphs' origins are 16 from the left and 16 from the bottom */
   x -= 16;
@@ -112,26 +166,26 @@ void draw_text(uint8_t* buf, int width, int height,
   if (radj)
     x -= text_width(s);
 
-  /* First clear all of the glyphs then set all of the glyphs */
-  for (int set = 0; set != 2; ++set) {
-    for (int i = 0; i < GLYPH_COUNT; ++i) {
-      indexes[i] = g_glyph_indexes[i];
-    }
-    int xx = x;
-    for (const char *ss = s; *ss; ++ss) {
-      int glyph = char_to_glyph(*ss);
-      if (glyph >= 0) {
-        draw_glyph(buf, width, height, xx, y, glyph, indexes[glyph], set);
-        xx += glyph_width(glyph);
-        indexes[glyph] = (indexes[glyph] + 1) % INDEX_COUNT;
+  for (const char *ss = s; *ss; ++ss) {
+    int glyph = char_to_glyph(*ss);
+    if (glyph < 0)
+      continue;
+    if (clip_glyph(&spans[count], width, height,
+                   x, y, glyph, indexes[glyph])) {
+      if (++count == MAX_SPANS) {
+        draw_spans(buf, width, spans, count);
+        count = 0;
       }
     }
+    x += glyph_width(glyph);
+    indexes[glyph] = (indexes[glyph] + 1) % INDEX_COUNT;
   }
+  draw_spans(buf, width, spans, count);
+}
 
-  /* Update the glyph indexes */
-  for (int i = 0; i < GLYPH_COUNT; ++i) {
-    g_glyph_indexes[i] = indexes[i];
-  }
+void draw_text(uint8_t* buf, int width, int height,
+               int x, int y, const char* s, int radj) {
+  draw_text_indexed(buf, width, height, x, y, s, radj, g_glyph_indexes);
 }
 
 int text_width(const char* s) {
@@ -140,3 +194,15 @@ int text_width(const char* s) {
     width += glyph_width(char_to_glyph(*s++));
   return width;
 }
+
+void text_get_glyph_state(uint8_t* indexes) {
+  for (int i = 0; i < GLYPH_COUNT; ++i) {
+    indexes[i] = g_glyph_indexes[i];
+  }
+}
+
+void text_set_glyph_state(const uint8_t* indexes) {
+  for (int i = 0; i < GLYPH_COUNT; ++i) {
+    g_glyph_indexes[i] = indexes[i] % INDEX_COUNT;
+  }
+}
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+/* Number of distinct glyphs, and the size of the glyph cycling state */
+#define TEXT_GLYPH_COUNT 13
+
 /* Drawn a string of hand-written digits zero to nine, plus symbol,
  * minus symbol and degree sign ('*')
  *
@@ -12,7 +15,23 @@
 void draw_text(uint8_t* buf, int width, int height,
                int x, int y, const char* s, int radj);
 
+/* Draw a string with the glyph variants given by indexes, a
+ * TEXT_GLYPH_COUNT array that is advanced past the glyphs drawn,
+ * instead of the cycling state. To draw the same text in pieces, e.g.
+ * one band of the frame at a time, start each piece from a copy of
+ * the same indexes.
+ */
+void draw_text_indexed(uint8_t* buf, int width, int height,
+                       int x, int y, const char* s, int radj,
+                       uint8_t* indexes);
+
 /* Calculate the width of the string in pixels. */
 int text_width(const char* buf);
 
+/* Get or set the variant of each glyph that will be drawn next, so
+ * that the cycling can be carried across deep sleep.
+ */
+void text_get_glyph_state(uint8_t* indexes);
+void text_set_glyph_state(const uint8_t* indexes);
+
 #endif
@@ -0,0 +1,237 @@
+#include "tls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ssl.h"
+
+#include "rtc_state.h"
+
+#define TAG "fc"
+
+_Static_assert(sizeof(mbedtls_ssl_session) <= RTC_TLS_SESSION_SIZE,
+               "RTC_TLS_SESSION_SIZE is too small for mbedtls_ssl_session");
+
+struct tls {
+  mbedtls_net_context net;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_ssl_config conf;
+  mbedtls_ssl_context ssl;
+  int connected;
+  int64_t start; /* When the handshake started */
+};
+
+static void log_error(const char* what, int ret) {
+  ESP_LOGE(TAG, "%s failed: -0x%04x", what, -ret);
+}
+
+/* Pass on that the socket would block, log any other error */
+static int check_error(const char* what, int ret) {
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ)
+    return TLS_WANT_READ;
+  if (ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+    return TLS_WANT_WRITE;
+  log_error(what, ret);
+  return TLS_ERROR;
+}
+
+/* Offer the session from the last wake, if any */
+static void restore_session(mbedtls_ssl_context* ssl) {
+  rtc_state_t* state = rtc_state();
+  mbedtls_ssl_session session;
+  int ret;
+
+  if (!state->tls_valid)
+    return;
+
+  /* The pointers in the saved copy are stale. The certificate isn't
+   * needed to resume, and the ticket is kept on the side. */
+  memcpy(&session, state->tls_session, sizeof(session));
+  session.peer_cert = NULL;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  session.ticket = state->tls_ticket_len ? state->tls_ticket : NULL;
+  session.ticket_len = state->tls_ticket_len;
+#endif
+
+  /* This makes a copy of the session */
+  ret = mbedtls_ssl_set_session(ssl, &session);
+  if (ret != 0)
+    log_error("Restoring the TLS session", ret);
+}
+
+/* Keep the session of the handshake for the next wake */
+static void save_session(mbedtls_ssl_context* ssl) {
+  rtc_state_t* state = rtc_state();
+  mbedtls_ssl_session session;
+
+  state->tls_valid = 0;
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_get_session(ssl, &session) != 0)
+    goto out;
+
+  state->tls_ticket_len = 0;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  /* A ticket too large to keep is dropped, the session ID may still
+   * work */
+  if (session.ticket != NULL && session.ticket_len <= RTC_TLS_TICKET_SIZE) {
+    memcpy(state->tls_ticket, session.ticket, session.ticket_len);
+    state->tls_ticket_len = session.ticket_len;
+  }
+#endif
+  memcpy(state->tls_session, &session, sizeof(session));
+  state->tls_valid = 1;
+
+ out:
+  mbedtls_ssl_session_free(&session);
+}
+
+/* Check the certificate of a full handshake against the fingerprint in
+ * menuconfig. Without one, tls_start has already refused unless any
+ * certificate is to be accepted. */
+static esp_err_t check_certificate(mbedtls_ssl_context* ssl) {
+  const mbedtls_x509_crt* crt = mbedtls_ssl_get_peer_cert(ssl);
+  unsigned char hash[32];
+  char hex[2*sizeof(hash)+1];
+
+  if (crt == NULL)
+    return ESP_FAIL;
+  mbedtls_sha256_ret(crt->raw.p, crt->raw.len, hash, 0);
+  for (int i = 0; i < sizeof(hash); ++i)
+    sprintf(hex + 2*i, "%02x", hash[i]);
+
+#if CONFIG_APIXU_CERT_INSECURE
+  if (CONFIG_APIXU_CERT_SHA256[0] == '\0') {
+    ESP_LOGW(TAG, "Accepting any server certificate, this one has "
+             "SHA-256 %s", hex);
+    return ESP_OK;
+  }
+#endif
+  if (strcasecmp(hex, CONFIG_APIXU_CERT_SHA256) != 0) {
+    ESP_LOGE(TAG, "Server certificate SHA-256 %s doesn't match", hex);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+tls_t* tls_start(int s, const char* host) {
+  tls_t* tls;
+  int ret;
+
+#if !CONFIG_APIXU_CERT_INSECURE
+  /* There is nothing else to check the server against */
+  if (CONFIG_APIXU_CERT_SHA256[0] == '\0') {
+    ESP_LOGE(TAG, "No server certificate fingerprint set, not using "
+             "https, see APIXU_CERT_SHA256 in menuconfig");
+    return NULL;
+  }
+#endif
+
+  tls = calloc(1, sizeof(*tls));
+  if (tls == NULL) {
+    ESP_LOGE(TAG, "Out of memory for TLS");
+    return NULL;
+  }
+  tls->start = esp_timer_get_time();
+  mbedtls_net_init(&tls->net);
+  tls->net.fd = s;
+  mbedtls_entropy_init(&tls->entropy);
+  mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+  mbedtls_ssl_config_init(&tls->conf);
+  mbedtls_ssl_init(&tls->ssl);
+
+  ret = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func,
+                              &tls->entropy, NULL, 0);
+  if (ret != 0) {
+    log_error("Seeding the TLS RNG", ret);
+    goto err;
+  }
+
+  ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT,
+                                    MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret != 0) {
+    log_error("TLS config", ret);
+    goto err;
+  }
+  /* The certificate is pinned instead, see check_certificate */
+  mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+
+  ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+  if (ret == 0)
+    ret = mbedtls_ssl_set_hostname(&tls->ssl, host);
+  if (ret != 0) {
+    log_error("TLS setup", ret);
+    goto err;
+  }
+  restore_session(&tls->ssl);
+  mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send,
+                      mbedtls_net_recv, NULL);
+  return tls;
+
+ err:
+  tls_close(tls);
+  return NULL;
+}
+
+int tls_handshake(tls_t* tls) {
+  int ret, resumed;
+
+  ret = mbedtls_ssl_handshake(&tls->ssl);
+  if (ret != 0) {
+    ret = check_error("TLS handshake", ret);
+    if (ret == TLS_ERROR)
+      rtc_state()->tls_valid = 0;
+    return ret;
+  }
+  tls->connected = 1;
+
+  /* A resumed session has no certificate: it was checked when the
+   * session was set up */
+  resumed = mbedtls_ssl_get_peer_cert(&tls->ssl) == NULL;
+  if (!resumed && check_certificate(&tls->ssl) != ESP_OK) {
+    rtc_state()->tls_valid = 0;
+    return TLS_ERROR;
+  }
+  save_session(&tls->ssl);
+
+  ESP_LOGI(TAG, "TLS handshake %s in %u ms, %s",
+           resumed ? "resumed" : "full",
+           (uint32_t)((esp_timer_get_time() - tls->start) / 1000),
+           mbedtls_ssl_get_ciphersuite(&tls->ssl));
+  return 0;
+}
+
+int tls_write(tls_t* tls, const void* buf, size_t len) {
+  int ret = mbedtls_ssl_write(&tls->ssl, buf, len);
+
+  return ret < 0 ? check_error("TLS write", ret) : ret;
+}
+
+int tls_read(tls_t* tls, void* buf, size_t len) {
+  int ret = mbedtls_ssl_read(&tls->ssl, buf, len);
+
+  if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+    return 0;
+  return ret < 0 ? check_error("TLS read", ret) : ret;
+}
+
+void tls_close(tls_t* tls) {
+  if (tls->connected)
+    mbedtls_ssl_close_notify(&tls->ssl);
+  /* Not mbedtls_net_free, the socket belongs to the caller */
+  mbedtls_ssl_free(&tls->ssl);
+  mbedtls_ssl_config_free(&tls->conf);
+  mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+  mbedtls_entropy_free(&tls->entropy);
+  free(tls);
+}
@@ -0,0 +1,52 @@
+#ifndef __TLS_H__
+#define __TLS_H__
+
+#include <stddef.h>
+
+#include "esp_system.h"
+
+/* TLS client on a connected, non-blocking socket, using mbedTLS.
+ *
+ * The session of the last handshake is kept in RTC memory and offered
+ * to the server on the next connect, so that most wakes do an
+ * abbreviated handshake, without the certificate and key exchange.
+ *
+ * There is no CA store: the server certificate must have the fingerprint
+ * in CONFIG_APIXU_CERT_SHA256, and without one no connection is made,
+ * unless CONFIG_APIXU_CERT_INSECURE says to accept any certificate.
+ * Only sessions that passed this check are kept for resuming.
+ */
+
+typedef struct tls tls_t;
+
+/* Returned when the socket would block: call again once it is readable
+ * or writable. The socket is non-blocking. */
+#define TLS_WANT_READ  (-2)
+#define TLS_WANT_WRITE (-3)
+/* Any other failure, logged */
+#define TLS_ERROR      (-1)
+
+/* Set up TLS on the connected socket s, for host. Returns NULL on
+ * failure.
+ */
+tls_t* tls_start(int s, const char* host);
+
+/* Do the next step of the handshake. Returns 0 once done, or one of
+ * the codes above.
+ */
+int tls_handshake(tls_t* tls);
+
+/* Write some of buf. Returns the number of bytes written, or one of
+ * the codes above.
+ */
+int tls_write(tls_t* tls, const void* buf, size_t len);
+
+/* Read up to len bytes. Returns the number read, 0 when the server
+ * closed the connection, or one of the codes above.
+ */
+int tls_read(tls_t* tls, void* buf, size_t len);
+
+/* Close the TLS connection and free it. The socket is left open. */
+void tls_close(tls_t* tls);
+
+#endif
@@ -0,0 +1,100 @@
+#include "wall_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_log.h"
+
+#include "rtc_state.h"
+
+#define TAG "fc"
+
+/* Leave the clock alone if it is off by less than this */
+#define WALL_CLOCK_SLACK_S 2
+
+static const char g_months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+/* Days from 1970-01-01 to the given date */
+static int64_t days_from_civil(int y, int m, int d) {
+  int era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return (int64_t)era * 146097 + doe - 719468;
+}
+
+/* Move the times kept in RTC memory along with a clock step, so that
+ * they stay the same distance from now */
+static void shift_times(rtc_state_t* state, int64_t delta_us) {
+  int64_t delta = delta_us / 1000000;
+
+  if (state->dns_addr != 0)
+    state->dns_expires += delta;
+  if (state->wifi_ip != 0)
+    state->wifi_lease_time += delta;
+  if (state->schedule_fetch_at != 0)
+    state->schedule_fetch_at += delta;
+  if (state->epd_wake_at != 0)
+    state->epd_wake_at += delta_us;
+}
+
+void wall_clock_init(void) {
+  setenv("TZ", CONFIG_FORECAST_TZ, 1);
+  tzset();
+}
+
+void wall_clock_set_http_date(const char* date) {
+  rtc_state_t* state = rtc_state();
+  struct timeval now, tv;
+  int64_t delta_us;
+  char month[4];
+  const char* m;
+  int day, year, hour, min, sec;
+
+  /* "Sun, 06 Nov 1994 08:49:37 GMT", the only format servers send */
+  if (sscanf(date, "%*3s, %d %3s %d %d:%d:%d GMT",
+             &day, month, &year, &hour, &min, &sec) != 6)
+    return;
+  m = strstr(g_months, month);
+  if (strlen(month) != 3 || m == NULL || (m - g_months) % 3 != 0)
+    return;
+  /* Anything out of range would step the clock, and the times kept
+   * with it, to nonsense */
+  if (day < 1 || day > 31 || year < 2000 || year > 2100
+      || hour < 0 || hour > 23 || min < 0 || min > 59
+      || sec < 0 || sec > 60) {
+    ESP_LOGW(TAG, "Ignoring Date %s", date);
+    return;
+  }
+
+  tv.tv_sec = days_from_civil(year, (m - g_months) / 3 + 1, day) * 86400
+    + hour * 3600 + min * 60 + sec;
+  tv.tv_usec = 0;
+
+  gettimeofday(&now, NULL);
+  delta_us = ((int64_t)tv.tv_sec - now.tv_sec) * 1000000 - now.tv_usec;
+  if (!state->clock_valid) {
+    settimeofday(&tv, NULL);
+    shift_times(state, delta_us);
+    ESP_LOGI(TAG, "Clock set to %s", date);
+  } else if (llabs((int64_t)tv.tv_sec - now.tv_sec) > WALL_CLOCK_SLACK_S) {
+    settimeofday(&tv, NULL);
+    shift_times(state, delta_us);
+    ESP_LOGI(TAG, "Clock corrected by %d s", (int)(tv.tv_sec - now.tv_sec));
+  }
+  state->clock_valid = 1;
+}
+
+int wall_clock_valid(void) {
+  return rtc_state()->clock_valid;
+}
+
+int32_t wall_clock_local_day(time_t t, struct tm* tm) {
+  localtime_r(&t, tm);
+  return days_from_civil(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+}
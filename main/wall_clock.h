@@ -0,0 +1,32 @@
+#ifndef __WALL_CLOCK_H__
+#define __WALL_CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* Wall clock time, without SNTP.
+ *
+ * The system time keeps running through deep sleep. It is set from the
+ * Date header of the forecast responses, so it is corrected at every
+ * fetch. Local time follows CONFIG_FORECAST_TZ.
+ */
+
+/* Set up the time zone. Call once at boot, after rtc_state_load. */
+void wall_clock_init(void);
+
+/* Set the clock from an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37
+ * GMT". Ignored if malformed, or if a field is out of range, the year
+ * outside 2000 to 2100. The system times kept in the RTC state (DNS
+ * expiry, DHCP lease, next fetch and display wake) are moved by the
+ * same step.
+ */
+void wall_clock_set_http_date(const char* date);
+
+/* Whether the clock has been set since the RTC state was reset */
+int wall_clock_valid(void);
+
+/* The local date at t, in days since 1970. Fills in tm with the local
+ * time too. */
+int32_t wall_clock_local_day(time_t t, struct tm* tm);
+
+#endif
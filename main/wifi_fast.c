@@ -0,0 +1,161 @@
+#include "wifi_fast.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/ip_addr.h"
+#include "lwip/sockets.h"
+#include "tcpip_adapter.h"
+
+#include "rtc_state.h"
+
+#define TAG "fc"
+
+/* Connecting to the cached AP */
+static int g_fast;
+/* Using a static address, or a lease from an earlier wake */
+static int g_static;
+static int g_lease;
+
+/* The address from menuconfig, if any */
+static int static_address(tcpip_adapter_ip_info_t* info,
+                          tcpip_adapter_dns_info_t* dns) {
+  if (CONFIG_WIFI_STATIC_IP[0] == '\0')
+    return 0;
+
+  info->ip.addr = inet_addr(CONFIG_WIFI_STATIC_IP);
+  info->netmask.addr = inet_addr(CONFIG_WIFI_STATIC_NETMASK);
+  info->gw.addr = inet_addr(CONFIG_WIFI_STATIC_GATEWAY);
+  if (CONFIG_WIFI_STATIC_DNS[0] != '\0')
+    dns->ip.u_addr.ip4.addr = inet_addr(CONFIG_WIFI_STATIC_DNS);
+  else
+    dns->ip.u_addr.ip4.addr = info->gw.addr;
+  return 1;
+}
+
+/* The lease from an earlier wake, unless it is too old */
+static int cached_lease(tcpip_adapter_ip_info_t* info,
+                        tcpip_adapter_dns_info_t* dns) {
+  rtc_state_t* state = rtc_state();
+
+  if (!state->wifi_valid || state->wifi_ip == 0
+      || time(NULL) - state->wifi_lease_time >= CONFIG_WIFI_LEASE_REUSE_TIME)
+    return 0;
+
+  info->ip.addr = state->wifi_ip;
+  info->netmask.addr = state->wifi_netmask;
+  info->gw.addr = state->wifi_gw;
+  dns->ip.u_addr.ip4.addr = state->wifi_dns;
+  return 1;
+}
+
+/* Use a fixed address instead of DHCP */
+static esp_err_t set_address(const tcpip_adapter_ip_info_t* info,
+                             tcpip_adapter_dns_info_t* dns) {
+  esp_err_t ret;
+
+  ret = tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+  if (ret != ESP_OK && ret != ESP_ERR_TCPIP_ADAPTER_DHCP_ALREADY_STOPPED)
+    return ret;
+  ret = tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, info);
+  if (ret != ESP_OK)
+    return ret;
+  return tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA,
+                                    TCPIP_ADAPTER_DNS_MAIN, dns);
+}
+
+int wifi_fast_prepare(wifi_config_t* config) {
+  rtc_state_t* state = rtc_state();
+  tcpip_adapter_ip_info_t info;
+  tcpip_adapter_dns_info_t dns;
+
+  memset(&info, 0, sizeof(info));
+  memset(&dns, 0, sizeof(dns));
+  dns.ip.type = IPADDR_TYPE_V4;
+
+  g_static = static_address(&info, &dns);
+  g_lease = !g_static && cached_lease(&info, &dns);
+  if ((g_static || g_lease) && set_address(&info, &dns) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to set the IP address, using DHCP");
+    tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+    g_static = g_lease = 0;
+  }
+
+  g_fast = state->wifi_valid;
+  if (g_fast) {
+    config->sta.bssid_set = true;
+    memcpy(config->sta.bssid, state->wifi_bssid, sizeof(state->wifi_bssid));
+    config->sta.channel = state->wifi_channel;
+  }
+
+  ESP_LOGI(TAG, "Wifi: %s, %s", g_fast ? "cached AP" : "scanning",
+           g_static ? "static IP" : g_lease ? "cached lease" : "DHCP");
+  return g_fast;
+}
+
+void wifi_fast_event(const system_event_t* event) {
+  rtc_state_t* state = rtc_state();
+  const tcpip_adapter_ip_info_t* info;
+  tcpip_adapter_dns_info_t dns;
+
+  switch (event->event_id) {
+  case SYSTEM_EVENT_STA_CONNECTED:
+    memcpy(state->wifi_bssid, event->event_info.connected.bssid,
+           sizeof(state->wifi_bssid));
+    state->wifi_channel = event->event_info.connected.channel;
+    state->wifi_valid = 1;
+    break;
+
+  case SYSTEM_EVENT_STA_GOT_IP:
+    info = &event->event_info.got_ip.ip_info;
+    if (!g_static && !g_lease) {
+      /* A fresh lease, keep it for the next wakes */
+      state->wifi_ip = info->ip.addr;
+      state->wifi_netmask = info->netmask.addr;
+      state->wifi_gw = info->gw.addr;
+      if (tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA,
+                                     TCPIP_ADAPTER_DNS_MAIN, &dns) == ESP_OK)
+        state->wifi_dns = dns.ip.u_addr.ip4.addr;
+      else
+        state->wifi_dns = info->gw.addr;
+      state->wifi_lease_time = time(NULL);
+    }
+    ESP_LOGI(TAG, "Got IP " IPSTR " %u ms after boot (%s, %s)",
+             IP2STR(&info->ip), (uint32_t)(esp_timer_get_time() / 1000),
+             g_fast ? "cached AP" : "scanned",
+             g_static ? "static IP" : g_lease ? "cached lease" : "DHCP");
+    break;
+
+  default:
+    break;
+  }
+}
+
+void wifi_fast_fallback(void) {
+  rtc_state_t* state = rtc_state();
+  wifi_config_t config;
+
+  if (!g_fast)
+    return;
+
+  ESP_LOGW(TAG, "Fast connect failed, scanning%s",
+           g_lease ? " and using DHCP" : "");
+  g_fast = 0;
+  state->wifi_valid = 0;
+  if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+    config.sta.bssid_set = false;
+    config.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+  }
+  if (g_lease) {
+    g_lease = 0;
+    state->wifi_ip = 0;
+    tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+  }
+}
+
+int wifi_fast_active(void) {
+  return g_fast;
+}
@@ -0,0 +1,40 @@
+#ifndef __WIFI_FAST_H__
+#define __WIFI_FAST_H__
+
+#include "esp_event_loop.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+
+/* Fast reconnect after deep sleep.
+ *
+ * The AP we last associated with, its channel and the DHCP lease we
+ * got are kept in RTC memory. The next wake connects to that BSSID on
+ * that channel, skipping the scan, and configures the lease directly,
+ * skipping DHCP. A static IP set in menuconfig skips DHCP always.
+ *
+ * If the fast connect fails, the cache is dropped and we fall back to
+ * scanning and DHCP.
+ */
+
+/* Fill in the BSSID and channel and set up the interface address.
+ * Call after tcpip_adapter_init and before esp_wifi_start. Returns 1 if
+ * the connect will be a fast one.
+ */
+int wifi_fast_prepare(wifi_config_t* config);
+
+/* Call from the event handler on SYSTEM_EVENT_STA_CONNECTED and
+ * SYSTEM_EVENT_STA_GOT_IP, to record the AP and the lease.
+ */
+void wifi_fast_event(const system_event_t* event);
+
+/* Forget the cached AP and lease and go back to scanning and DHCP for
+ * the next connect. Call from the event handler on
+ * SYSTEM_EVENT_STA_DISCONNECTED, before reconnecting. Does nothing
+ * unless a fast connect is in progress.
+ */
+void wifi_fast_fallback(void);
+
+/* Whether we connected, or are connecting, the fast way */
+int wifi_fast_active(void);
+
+#endif
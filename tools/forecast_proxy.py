@@ -0,0 +1,186 @@
+#!/usr/bin/env python
+#
+# Serve the forecast as the binary record of main/forecast_wire.h.
+#
+#   forecast_proxy.py [--port PORT] [--hours] URL
+#   forecast_proxy.py [--port PORT] [--hours] --replay FILE
+#
+# Fetches the provider's JSON forecast from URL, at most once every
+# --refresh seconds, or reads it from FILE, and answers every GET with
+# the converted record. Then set in menuconfig:
+#   APIXU_URL         http://<address of this machine>:PORT/
+#   APIXU_PORT        PORT, 8080 by default
+#   FORECAST_BINARY   y
+#
+# Without --hours, the record holds the days only, with their sunrise
+# and sunset, 32 bytes for two days instead of several kB of JSON. The ETag covers the forecast, so
+# a device asking again for the same one gets a 304. The valid until
+# field is when the proxy expects the provider to update, --update
+# seconds after the last fetch; the device doesn't fetch before then.
+
+from __future__ import print_function
+
+import argparse
+import hashlib
+import json
+import struct
+import sys
+import time
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from urllib.request import urlopen
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from urllib2 import urlopen
+
+# Must match main/forecast_wire.h
+WIRE_MAGIC = b"FC"
+WIRE_VERSION = 1
+WIRE_HEADER = struct.Struct("<2sBBBB2xiI")
+WIRE_DAY = struct.Struct("<Hbb")
+WIRE_HOUR = struct.Struct("<HbB")
+WIRE_SUN = struct.Struct("<BB2x")
+WIRE_FLAG_SUN = 0x01
+WIRE_MAX_DAYS = 255
+
+DAY_S = 24 * 60 * 60
+
+
+def temp(value):
+    """To the nearest degree, halves away from zero, exactly like the
+    JSON parser on the device"""
+    value = max(-128.0, min(127.0, value))
+    return int(value - 0.5 if value < 0 else value + 0.5)
+
+
+def sun_hour(value):
+    """The hour nearest to a time like "07:19 AM", like the device"""
+    t = time.strptime(value, "%I:%M %p")
+    return (t.tm_hour * 60 + t.tm_min + 30) // 60 % 24
+
+
+def sun_times(days):
+    """The sunrise and sunset hour of each day, or None if any is
+    missing"""
+    try:
+        return [(sun_hour(d["astro"]["sunrise"]),
+                 sun_hour(d["astro"]["sunset"])) for d in days]
+    except (KeyError, ValueError):
+        return None
+
+
+def encode(forecast, hours, valid_until):
+    """Convert the provider's JSON forecast to a record"""
+    days = forecast["forecast"]["forecastday"][:WIRE_MAX_DAYS]
+    if not days:
+        raise ValueError("no forecast days")
+    first_day = days[0]["date_epoch"] // DAY_S
+    sun = sun_times(days)
+    record = [WIRE_HEADER.pack(WIRE_MAGIC, WIRE_VERSION, len(days),
+                               24 if hours else 0,
+                               WIRE_FLAG_SUN if sun else 0,
+                               first_day, valid_until)]
+    for d in days:
+        day = d["day"]
+        record.append(WIRE_DAY.pack(day["condition"]["code"],
+                                    temp(day["mintemp_c"]),
+                                    temp(day["maxtemp_c"])))
+    if hours:
+        for d in days:
+            hour = d.get("hour", [])
+            if len(hour) != 24:
+                raise ValueError("day without 24 hours")
+            for h in hour:
+                record.append(WIRE_HOUR.pack(h["condition"]["code"],
+                                             temp(h["temp_c"]),
+                                             1 if h["is_day"] else 0))
+    if sun:
+        for sunrise, sunset in sun:
+            record.append(WIRE_SUN.pack(sunrise, sunset))
+    return b"".join(record)
+
+
+def etag(record):
+    """A validator for the forecast, whatever its valid until time"""
+    h = hashlib.sha1(record[:12] + record[16:]).hexdigest()
+    return '"%s"' % h[:16]
+
+
+class Forecast(object):
+    def __init__(self, args):
+        self.args = args
+        self.record = None
+        self.fetched = 0
+
+    def get(self):
+        now = time.time()
+        if self.record is None or now - self.fetched >= self.args.refresh:
+            if self.args.replay:
+                with open(self.args.replay) as f:
+                    data = f.read()
+            else:
+                data = urlopen(self.args.url, timeout=30).read()
+                data = data.decode("utf-8")
+            valid_until = int(now) + self.args.update
+            self.record = encode(json.loads(data), self.args.hours,
+                                 valid_until)
+            self.fetched = now
+            print("Fetched %d bytes, converted to %d" %
+                  (len(data), len(self.record)), file=sys.stderr)
+        return self.record
+
+
+def handler(forecast):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.0"
+
+        def do_GET(self):
+            try:
+                record = forecast.get()
+            except Exception as e:
+                print("Can't get the forecast: %s" % e, file=sys.stderr)
+                self.send_error(502)
+                return
+            tag = etag(record)
+            if self.headers.get("If-None-Match") == tag:
+                self.send_response(304)
+                self.send_header("ETag", tag)
+                self.end_headers()
+                return
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(record)))
+            self.send_header("ETag", tag)
+            self.end_headers()
+            self.wfile.write(record)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Serve the forecast as a binary record")
+    parser.add_argument("url", nargs="?",
+                        help="URL of the provider's JSON forecast")
+    parser.add_argument("--replay", metavar="FILE",
+                        help="read the JSON forecast from FILE instead")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--hours", action="store_true",
+                        help="include the hours of each day")
+    parser.add_argument("--refresh", type=int, default=600,
+                        help="seconds between fetches from the provider")
+    parser.add_argument("--update", type=int, default=900,
+                        help="seconds until the provider updates, "
+                        "after a fetch")
+    args = parser.parse_args()
+    if not args.url and not args.replay:
+        parser.error("give a URL or --replay FILE")
+
+    server = HTTPServer(("", args.port), handler(Forecast(args)))
+    print("Listening on port %d" % args.port, file=sys.stderr)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,273 @@
+#!/usr/bin/env python
+#
+# Generate the compressed icons, the glyph atlas and their metrics.
+#
+#   gen_assets.py OUTDIR GLYPHS.raw GLYPHS.txt ICON.raw...
+#
+# Writes OUTDIR/assets_gen.h, with the sizes and indexes, and
+# OUTDIR/assets_gen.inc, with the data tables, which is included by
+# assets.c only.
+#
+# The icons are 1 bpp frames, one bit per pixel and 1 for white, rows
+# top to bottom. Each one is compressed with whichever codec makes it
+# smallest, see assets.h for the formats. Short icons are padded with
+# white.
+#
+# The glyph image holds GLYPH_COUNT glyphs side by side and
+# GLYPH_VARIANTS variants of them top to bottom, each GLYPH_SIZE
+# square. Each row of 8 pixels is an ink byte (0 is black) followed by
+# a mask byte (1 is cleared to white). The atlas keeps only the
+# bounding box of the non-blank pixels of each glyph, in byte columns,
+# with the ink bytes of a row followed by its mask bytes.
+#
+# GLYPHS.txt lists the glyphs in order, one "char width" pair per line,
+# where width is the advance to the next glyph in pixels.
+
+from __future__ import print_function
+
+import os
+import sys
+
+ICON_WIDTH = 200
+ICON_HEIGHT = 200
+ICON_SIZE = ICON_WIDTH // 8 * ICON_HEIGHT
+
+GLYPH_VARIANTS = 8
+GLYPH_SIZE = 64
+
+# Must match assets.h
+CODEC_RAW = 0
+CODEC_RLE = 1
+CODEC_LZ = 2
+CODEC_NAMES = {CODEC_RAW: "RAW", CODEC_RLE: "RLE", CODEC_LZ: "LZ"}
+
+LZ_WINDOW = 256
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = 0x7F + LZ_MIN_MATCH
+RLE_MIN_RUN = 2
+RLE_MAX_RUN = 0x7F + RLE_MIN_RUN
+MAX_LITERALS = 0x80
+
+
+def flush_literals(out, lit):
+    while lit:
+        chunk = lit[:MAX_LITERALS]
+        out.append(len(chunk) - 1)
+        out.extend(chunk)
+        del lit[:MAX_LITERALS]
+
+
+def rle_compress(data):
+    out = bytearray()
+    lit = bytearray()
+    i = 0
+    while i < len(data):
+        j = i
+        while j < len(data) and data[j] == data[i] and j - i < RLE_MAX_RUN:
+            j += 1
+        if j - i >= RLE_MIN_RUN:
+            flush_literals(out, lit)
+            out.append(0x80 | (j - i - RLE_MIN_RUN))
+            out.append(data[i])
+            i = j
+        else:
+            lit.append(data[i])
+            i += 1
+    flush_literals(out, lit)
+    return out
+
+
+def lz_compress(data):
+    out = bytearray()
+    lit = bytearray()
+    heads = {}
+    i = 0
+    while i < len(data):
+        best_len = 0
+        best_dist = 0
+        key = bytes(data[i:i + LZ_MIN_MATCH])
+        for pos in reversed(heads.get(key, [])):
+            dist = i - pos
+            if dist > LZ_WINDOW:
+                break
+            n = 0
+            while (i + n < len(data) and n < LZ_MAX_MATCH
+                   and data[pos + n] == data[i + n]):
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, dist
+        if best_len >= LZ_MIN_MATCH:
+            flush_literals(out, lit)
+            out.append(0x80 | (best_len - LZ_MIN_MATCH))
+            out.append(best_dist - 1)
+            step = best_len
+        else:
+            lit.append(data[i])
+            step = 1
+        for k in range(i, i + step):
+            heads.setdefault(bytes(data[k:k + LZ_MIN_MATCH]), []).append(k)
+        i += step
+    flush_literals(out, lit)
+    return out
+
+
+def compress(data):
+    """Returns (codec, data) for the smallest encoding, preferring the
+    faster codec on ties."""
+    candidates = [(len(data), CODEC_RAW, bytearray(data))]
+    for codec, fn in ((CODEC_RLE, rle_compress), (CODEC_LZ, lz_compress)):
+        packed = fn(data)
+        candidates.append((len(packed), codec, packed))
+    size, codec, packed = min(candidates, key=lambda c: (c[0], c[1]))
+    return codec, packed
+
+
+def read_icon(path):
+    with open(path, "rb") as f:
+        data = bytearray(f.read())
+    if len(data) > ICON_SIZE:
+        sys.exit("%s: %d bytes, expected %d" % (path, len(data), ICON_SIZE))
+    if len(data) < ICON_SIZE:
+        print("%s: %d bytes, padding to %d with white"
+              % (path, len(data), ICON_SIZE), file=sys.stderr)
+        data.extend(b"\xff" * (ICON_SIZE - len(data)))
+    return data
+
+
+def read_glyph_metrics(path):
+    glyphs = []
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].split()
+            if not line:
+                continue
+            glyphs.append((line[0], int(line[1])))
+    return glyphs
+
+
+def build_atlas(path, count):
+    with open(path, "rb") as f:
+        data = bytearray(f.read())
+    row_size = count * GLYPH_SIZE * 2 // 8
+    if len(data) != row_size * GLYPH_SIZE * GLYPH_VARIANTS:
+        sys.exit("%s: %d bytes, expected %d glyphs"
+                 % (path, len(data), count))
+
+    atlas = bytearray()
+    boxes = []
+    for glyph in range(count):
+        variants = []
+        for variant in range(GLYPH_VARIANTS):
+            def byte(gy, gx, plane):
+                return data[(variant * GLYPH_SIZE + gy) * row_size
+                            + glyph * GLYPH_SIZE * 2 // 8 + 2 * gx + plane]
+            cells = [(gy, gx) for gy in range(GLYPH_SIZE)
+                     for gx in range(GLYPH_SIZE // 8)
+                     if byte(gy, gx, 0) != 0xFF or byte(gy, gx, 1) != 0x00]
+            if not cells:
+                variants.append((0, -1, 0, -1, len(atlas)))
+                continue
+            top = min(c[0] for c in cells)
+            bottom = max(c[0] for c in cells)
+            left = min(c[1] for c in cells)
+            right = max(c[1] for c in cells)
+            variants.append((top, bottom, left, right, len(atlas)))
+            for gy in range(top, bottom + 1):
+                for plane in (0, 1):
+                    for gx in range(left, right + 1):
+                        atlas.append(byte(gy, gx, plane))
+        boxes.append(variants)
+    return atlas, boxes
+
+
+def c_bytes(data, indent="  "):
+    lines = []
+    for i in range(0, len(data), 12):
+        lines.append(indent + ", ".join("0x%02x" % b for b in data[i:i + 12])
+                     + ",")
+    return "\n".join(lines)
+
+
+def write_lines(path, lines):
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main(argv):
+    if len(argv) < 4:
+        sys.exit("usage: gen_assets.py OUTDIR GLYPHS.raw GLYPHS.txt ICON.raw...")
+    outdir, glyphs_raw, glyphs_txt, icon_paths = (argv[0], argv[1], argv[2],
+                                                  argv[3:])
+
+    metrics = read_glyph_metrics(glyphs_txt)
+    atlas, boxes = build_atlas(glyphs_raw, len(metrics))
+
+    icons = []
+    icon_data = bytearray()
+    for path in icon_paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        codec, packed = compress(read_icon(path))
+        icons.append((name, codec, len(icon_data), len(packed)))
+        icon_data.extend(packed)
+
+    header = []
+    header.append("/* Generated by tools/gen_assets.py, do not edit. */")
+    header.append("#ifndef __ASSETS_GEN_H__")
+    header.append("#define __ASSETS_GEN_H__")
+    header.append("")
+    header.append("#define ASSETS_ICON_WIDTH %d" % ICON_WIDTH)
+    header.append("#define ASSETS_ICON_HEIGHT %d" % ICON_HEIGHT)
+    header.append("#define ASSETS_ICON_COUNT %d" % len(icons))
+    for i, icon in enumerate(icons):
+        header.append("#define ASSETS_ICON_%s %d" % (icon[0].upper(), i))
+    header.append("")
+    header.append("#define ASSETS_GLYPH_SIZE %d" % GLYPH_SIZE)
+    header.append("#define ASSETS_GLYPH_COUNT %d" % len(metrics))
+    header.append("#define ASSETS_GLYPH_VARIANTS %d" % GLYPH_VARIANTS)
+    header.append("")
+    header.append("#endif")
+
+    inc = []
+    inc.append("/* Generated by tools/gen_assets.py, do not edit. */")
+    inc.append("")
+    for name, codec, offset, size in icons:
+        inc.append("/* %s: %d bytes, %s */" % (name, size, CODEC_NAMES[codec]))
+    inc.append("const assets_blob_t assets_icons[ASSETS_ICON_COUNT] = {")
+    for name, codec, offset, size in icons:
+        inc.append("  {%d, %d, ASSETS_CODEC_%s}, /* %s */"
+                   % (offset, size, CODEC_NAMES[codec], name))
+    inc.append("};")
+    inc.append("")
+    inc.append("const uint8_t assets_icon_data[%d] = {" % len(icon_data))
+    inc.append(c_bytes(icon_data))
+    inc.append("};")
+    inc.append("")
+    inc.append("const uint8_t assets_glyph_widths[ASSETS_GLYPH_COUNT] = {")
+    for char, width in metrics:
+        inc.append("  %d, /* '%s' */" % (width, char))
+    inc.append("};")
+    inc.append("")
+    inc.append("const assets_glyph_t "
+               "assets_glyphs[ASSETS_GLYPH_COUNT][ASSETS_GLYPH_VARIANTS] = {")
+    for (char, width), variants in zip(metrics, boxes):
+        inc.append("  { /* '%s' */" % char)
+        for top, bottom, left, right, offset in variants:
+            inc.append("    {%d, %d, %d, %d, %d},"
+                       % (top, bottom, left, right, offset))
+        inc.append("  },")
+    inc.append("};")
+    inc.append("")
+    inc.append("const uint8_t assets_glyph_atlas[%d] = {" % max(len(atlas), 1))
+    inc.append(c_bytes(atlas) if atlas else "  0,")
+    inc.append("};")
+
+    write_lines(os.path.join(outdir, "assets_gen.h"), header)
+    write_lines(os.path.join(outdir, "assets_gen.inc"), inc)
+
+    print("Assets: %d icons in %d bytes, %d glyphs in %d bytes"
+          % (len(icons), len(icon_data), len(metrics) * GLYPH_VARIANTS,
+             len(atlas)))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Serve a canned forecast over TLS, to test the https path and session
+# resumption without the real API.
+#
+#   tools/tls_stand_in.sh [PORT [CODE MIN MAX]]
+#
+# Then set in menuconfig:
+#   APIXU_URL          https://<address of this machine>/forecast.json
+#   APIXU_PORT         PORT, 8443 by default
+#   APIXU_CERT_SHA256  the fingerprint printed at startup
+#
+# The first wake logs "TLS handshake full in N ms", the next ones
+# "TLS handshake resumed in N ms". openssl s_server takes both session
+# IDs and tickets; add -no_ticket to the s_server line to test resuming
+# by session ID only.
+
+set -e
+
+PORT=${1:-8443}
+CODE=${2:-1000}
+MIN=${3:-3}
+MAX=${4:-14}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT INT TERM
+cd "$DIR"
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+  -days 30 -subj /CN=forecast-stand-in -keyout key.pem -out cert.pem \
+  2>/dev/null
+
+# With -HTTP, s_server sends the file as the complete response. One
+# day, today, without hours; the Date header sets the device clock.
+printf 'HTTP/1.0 200 OK\r\nDate: %s\r\nContent-Type: application/json\r\n\r\n' \
+  "$(LC_ALL=C date -u '+%a, %d %b %Y %H:%M:%S GMT')" > forecast.json
+printf '{"forecast":{"forecastday":[{"date_epoch":%s,"day":{"maxtemp_c":%s,"mintemp_c":%s,"condition":{"code":%s}}}]}}\n' \
+  "$(( $(date -u +%s) / 86400 * 86400 ))" "$MAX" "$MIN" "$CODE" \
+  >> forecast.json
+
+echo "Certificate SHA-256:" \
+  "$(openssl x509 -in cert.pem -outform der | openssl dgst -sha256 \
+     | sed 's/.*= //')"
+echo "Listening on port $PORT"
+openssl s_server -quiet -accept "$PORT" -cert cert.pem -key key.pem -HTTP